@@ -0,0 +1,129 @@
+/*
+  Kernels for IsingOpenCLProvider. All of the lattice state lives on the device
+  for the whole run; every kernel uses one work-item per site, with
+  i=get_global_id(0) and (x,y)=(i%n,i/n).
+
+  The hash must match IsingPuzzle::hrng exactly.
+*/
+
+enum{
+  rng_group_bond_lr=1,
+  rng_group_bond_ud=2,
+  rng_group_flip=3,
+  rng_group_init=4
+};
+
+// Layout of the per-site bond byte
+#define BOND_LR 1u
+#define BOND_UD 2u
+
+uint hround(uint acc, uint data)
+{
+  acc += data * 2246822519U;
+  acc  = (acc<<13) | (acc>>(32-13));
+  return acc * 2654435761U;
+}
+
+uint hfinal(uint acc)
+{
+  acc ^= acc >> 15;
+  acc *= 2246822519U;
+  acc ^= acc >> 13;
+  acc *= 3266489917U;
+  acc ^= acc >> 16;
+  return acc;
+}
+
+uint hrng(uint seed, uint group, uint iter, uint pos)
+{
+  uint acc=0;
+  acc=hround(acc,seed);
+  acc=hround(acc,group);
+  acc=hround(acc,iter);
+  acc=hround(acc,pos);
+  return hfinal(acc);
+}
+
+__kernel void init_spins(uint n, uint seed, __global uchar *spins)
+{
+  uint i=get_global_id(0);
+  spins[i]=hrng(seed, rng_group_init, 0, i) & 1;
+}
+
+//! Also resets every site to be its own cluster, ready for propagation
+__kernel void create_bonds(uint n, uint seed, uint step, uint prob, __global const uchar *spins, __global uchar *bonds, __global uint *clusters)
+{
+  uint i=get_global_id(0);
+  uint x=i%n, y=i/n;
+
+  uchar sC=spins[i];
+  uchar sU=spins[ ((y+1)%n)*n + x ];
+  uchar sR=spins[ y*n + (x+1)%n ];
+
+  uchar b=0;
+  if(sC==sU && hrng(seed, rng_group_bond_ud, step, i) < prob){
+    b |= BOND_UD;
+  }
+  if(sC==sR && hrng(seed, rng_group_bond_lr, step, i) < prob){
+    b |= BOND_LR;
+  }
+  bonds[i]=b;
+  clusters[i]=i;
+}
+
+/*
+  One sweep of the reference label propagation, done in place. Labels only
+  ever decrease towards the cluster minimum, so reading a neighbour's old or
+  new value are both safe; a sweep where nobody writes *changed means every
+  label already equals the minimum over its bonded neighbours.
+*/
+__kernel void propagate(uint n, __global const uchar *bonds, __global uint *clusters, __global uint *changed)
+{
+  uint i=get_global_id(0);
+  uint x=i%n, y=i/n;
+  uint xL=(x+n-1)%n, yD=(y+n-1)%n;
+
+  uint prev=clusters[i];
+  uint curr=prev;
+  uchar b=bonds[i];
+  if(b & BOND_LR){
+    curr=min(curr, clusters[y*n+(x+1)%n]);
+  }
+  if(bonds[y*n+xL] & BOND_LR){
+    curr=min(curr, clusters[y*n+xL]);
+  }
+  if(b & BOND_UD){
+    curr=min(curr, clusters[((y+1)%n)*n+x]);
+  }
+  if(bonds[yD*n+x] & BOND_UD){
+    curr=min(curr, clusters[yD*n+x]);
+  }
+  if(curr!=prev){
+    clusters[i]=curr;
+    *changed=1;
+  }
+}
+
+/*
+  Pointer jumping, also in place. A label is always a site in the same
+  cluster whose own label is no larger, so this only shortens chains and
+  never needs to report a change; convergence is still decided by propagate.
+*/
+__kernel void jump(__global uint *clusters)
+{
+  uint i=get_global_id(0);
+  clusters[i]=clusters[clusters[i]];
+}
+
+//! flip_clusters and count_clusters in one pass; each root adds one to history[step]
+__kernel void flip_and_count(uint n, uint seed, uint step, __global const uint *clusters, __global uchar *spins, __global uint *history)
+{
+  uint i=get_global_id(0);
+  uint cluster=clusters[i];
+  if(hrng(seed, rng_group_flip, step, cluster) >> 31){
+    spins[i] ^= 1;
+  }
+  if(cluster==i){
+    atomic_inc(history+step);
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef user_ising_batch_hpp
+#define user_ising_batch_hpp
+
+#include "ising_fused.hpp"
+
+#include "tbb/enumerable_thread_specific.h"
+
+#include <numeric>
+
+/*
+  Runs many independent lattices in one call. Most of the lattices the
+  harness generates are too small for the strips of a single lattice to
+  cover the cost of spawning tasks, so instead of parallelising inside each
+  lattice the small ones are spread across the cores, one lattice per task,
+  with each running serially inside a private single-thread arena.
+
+  Lattices with n>=batch_intra_min_n (or a batch of one) are still worth
+  splitting, so those run first, one at a time, with the normal intra-lattice
+  parallelism. The small ones are sorted largest first so that the long ones
+  are picked up early rather than being left as the tail of the batch.
+
+  Execute on its own is the same as ising.fused.
+*/
+class IsingBatchProvider
+  : public IsingFusedProvider
+{
+protected:
+  enum{ batch_intra_min_n=256 };
+
+public:
+  IsingBatchProvider()
+  {}
+
+  //! Executes inputs[k] into outputs[k] for every k
+  void ExecuteBatch(
+         puzzler::ILog *log,
+         const std::vector<const puzzler::IsingInput*> &inputs,
+         const std::vector<puzzler::IsingOutput*> &outputs
+         ) const
+  {
+    if(inputs.size()!=outputs.size()){
+      throw std::invalid_argument("IsingBatchProvider - inputs and outputs differ in length.");
+    }
+
+    std::vector<unsigned> order(inputs.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+      return inputs[a]->n > inputs[b]->n;
+    });
+
+    unsigned nLarge=0;
+    while(nLarge<order.size() && (order.size()==1 || inputs[order[nLarge]]->n>=batch_intra_min_n)){
+      nLarge++;
+    }
+    log->LogInfo("Batch of %u lattices, %u intra-parallel and %u inter-parallel", unsigned(order.size()), nLarge, unsigned(order.size()-nLarge));
+
+    for(unsigned k=0; k<nLarge; k++){
+      Execute(log, inputs[order[k]], outputs[order[k]]);
+    }
+
+    tbb::enumerable_thread_specific<tbb::task_arena> arenas(1);
+    tbb::parallel_for(tbb::blocked_range<unsigned>(nLarge, order.size(), 1), [&](const tbb::blocked_range<unsigned> &r){
+      tbb::task_arena &serial=arenas.local();
+      for(unsigned k=r.begin(); k<r.end(); k++){
+        serial.execute([&](){
+          Execute(log, inputs[order[k]], outputs[order[k]]);
+        });
+      }
+    }, tbb::simple_partitioner());
+  }
+
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef user_ising_fused_hpp
+#define user_ising_fused_hpp
+
+#include "ising_packed.hpp"
+
+/*
+  Fuses create_bonds into the labelling. Each word of bonds is generated from
+  the packed spins just before its set bits are unioned, so the bond arrays
+  only ever exist in registers. The vertical bonds leaving the last row of
+  each strip are regenerated in the merge phase, which costs one extra row of
+  hashing per strip.
+
+  Per step the lattice traffic is then: read the spins while labelling, one
+  pass to flatten the labels, and one pass to flip and count.
+
+  The spins and labels come from the per-thread workspace (see
+  ising_uf.hpp), so back-to-back calls reuse the same (already faulted-in)
+  pages.
+*/
+class IsingFusedProvider
+  : public IsingPackedProvider
+{
+protected:
+  void create_clusters_fused(puzzler::ILog *log, unsigned n, uint32_t seed, unsigned step, uint32_t prob, const uint64_t *spins, label_t *cluster) const
+  {
+    log->LogVerbose("  create_clusters_fused %u", step);
+
+    unsigned W=words_per_row(n);
+    unsigned strips=strip_count(n);
+    IsingBondGenerator genUD(hrng_prefix(seed, rng_group_bond_ud, step), prob);
+    IsingBondGenerator genLR(hrng_prefix(seed, rng_group_bond_lr, step), prob);
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y0=strip_begin(n, strips, k), y1=strip_begin(n, strips, k+1);
+      for(unsigned i=y0*n; i<y1*n; i++){
+        cluster[i].store(i, std::memory_order_relaxed);
+      }
+      for(unsigned y=y0; y<y1; y++){
+        for(unsigned w=0; w<W; w++){
+          uint64_t lr=bonds_lr(n, W, spins, y, w, genLR);
+          while(lr){
+            unsigned x=w*64+__builtin_ctzll(lr);
+            lr &= lr-1;
+            cuf_union(cluster, y*n+x, y*n+(x+1)%n);
+          }
+          if(y+1<y1){
+            uint64_t ud=bonds_ud(n, W, spins, y, w, genUD);
+            while(ud){
+              unsigned x=w*64+__builtin_ctzll(ud);
+              ud &= ud-1;
+              cuf_union(cluster, y*n+x, (y+1)*n+x);
+            }
+          }
+        }
+      }
+    });
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y=strip_begin(n, strips, k+1)-1;
+      for(unsigned w=0; w<W; w++){
+        uint64_t ud=bonds_ud(n, W, spins, y, w, genUD);
+        while(ud){
+          unsigned x=w*64+__builtin_ctzll(ud);
+          ud &= ud-1;
+          cuf_union(cluster, y*n+x, ((y+1)%n)*n+x);
+        }
+      }
+    });
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        cluster[i].store(cuf_find(cluster, i), std::memory_order_relaxed);
+      }
+    });
+  }
+
+public:
+  IsingFusedProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    unsigned W=words_per_row(n);
+    WorkspacePool::Lease workspace(m_workspaces);
+    uint64_t *spins=workspace->get<uint64_t>(0, n*W);
+    label_t *clusters=workspace->get<label_t>(1, n*n);
+
+    tbb::parallel_for(0u, n, [&](unsigned y){
+      std::fill(spins+y*W, spins+(y+1)*W, 0);
+      for(unsigned x=0; x<n; x++){
+        spins[y*W+x/64] |= uint64_t(hrng(seed, rng_group_init, 0, y*n+x) & 1) << (x%64);
+      }
+    });
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_clusters_fused", [&](){
+        create_clusters_fused(log, n, seed, i, prob, spins, clusters);
+      });
+      timers.Run("flip_and_count_packed", [&](){
+        stats[i]=flip_and_count_packed(log, n, seed, i, clusters, spins);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef user_ising_hrng_hpp
+#define user_ising_hrng_hpp
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ISING_HRNG_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+  Generates bond bits 64 positions at a time, i.e. bit b of the result is
+  hrng(seed,group,iter,pos+b) < prob.
+
+  The first three hash rounds only depend on (seed,group,iter), so the
+  caller passes in that prefix (see IsingPuzzle::hround), and only the pos
+  round and hfinal are evaluated per position. The constants here must stay
+  identical to IsingPuzzle::hround and IsingPuzzle::hfinal.
+
+  The implementation is chosen once at runtime from the CPU features. It can
+  be forced with HPCE_ISING_HRNG=scalar|avx2|avx512, which is mostly useful
+  for checking that they all agree.
+*/
+class IsingBondGenerator
+{
+public:
+  typedef uint64_t (*bonds_fn_t)(uint32_t prefix, uint32_t prob, uint32_t pos, uint64_t mask);
+
+private:
+  uint32_t m_prefix;
+  uint32_t m_prob;
+  bonds_fn_t m_bonds;
+
+  static uint32_t final_round(uint32_t prefix, uint32_t pos)
+  {
+    uint32_t acc=prefix;
+    acc += pos * 2246822519U;
+    acc  = (acc<<13) | (acc>>(32-13));
+    acc *= 2654435761U;
+
+    acc ^= acc >> 15;
+    acc *= 2246822519U;
+    acc ^= acc >> 13;
+    acc *= 3266489917U;
+    acc ^= acc >> 16;
+    return acc;
+  }
+
+  //! Only hashes the positions selected by mask, so it is cheapest when few spins agree
+  static uint64_t bonds_scalar(uint32_t prefix, uint32_t prob, uint32_t pos, uint64_t mask)
+  {
+    uint64_t res=0;
+    while(mask){
+      unsigned b=__builtin_ctzll(mask);
+      mask &= mask-1;
+      res |= uint64_t(final_round(prefix, pos+b) < prob) << b;
+    }
+    return res;
+  }
+
+#ifdef ISING_HRNG_X86
+  __attribute__((target("avx2")))
+  static uint64_t bonds_avx2(uint32_t prefix, uint32_t prob, uint32_t pos, uint64_t mask)
+  {
+    const __m256i lane=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const __m256i vPrefix=_mm256_set1_epi32(prefix);
+    const __m256i k1=_mm256_set1_epi32(2246822519U);
+    const __m256i k2=_mm256_set1_epi32(2654435761U);
+    const __m256i k3=_mm256_set1_epi32(3266489917U);
+    const __m256i sign=_mm256_set1_epi32(0x80000000U);
+    const __m256i vProb=_mm256_xor_si256(_mm256_set1_epi32(prob), sign);
+
+    uint64_t res=0;
+    for(unsigned b=0; b<64; b+=8){
+      if( ((mask>>b)&0xFF)==0 ){
+        continue;
+      }
+      __m256i vPos=_mm256_add_epi32(_mm256_set1_epi32(pos+b), lane);
+      __m256i acc=_mm256_add_epi32(vPrefix, _mm256_mullo_epi32(vPos, k1));
+      acc=_mm256_or_si256(_mm256_slli_epi32(acc, 13), _mm256_srli_epi32(acc, 32-13));
+      acc=_mm256_mullo_epi32(acc, k2);
+
+      acc=_mm256_xor_si256(acc, _mm256_srli_epi32(acc, 15));
+      acc=_mm256_mullo_epi32(acc, k1);
+      acc=_mm256_xor_si256(acc, _mm256_srli_epi32(acc, 13));
+      acc=_mm256_mullo_epi32(acc, k3);
+      acc=_mm256_xor_si256(acc, _mm256_srli_epi32(acc, 16));
+
+      // No unsigned compare in AVX2, so bias both sides into signed range
+      __m256i lt=_mm256_cmpgt_epi32(vProb, _mm256_xor_si256(acc, sign));
+      res |= uint64_t(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(lt)))) << b;
+    }
+    return res & mask;
+  }
+
+  __attribute__((target("avx512f")))
+  static uint64_t bonds_avx512(uint32_t prefix, uint32_t prob, uint32_t pos, uint64_t mask)
+  {
+    const __m512i lane=_mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+    const __m512i vPrefix=_mm512_set1_epi32(prefix);
+    const __m512i k1=_mm512_set1_epi32(2246822519U);
+    const __m512i k2=_mm512_set1_epi32(2654435761U);
+    const __m512i k3=_mm512_set1_epi32(3266489917U);
+    const __m512i vProb=_mm512_set1_epi32(prob);
+    // The maskz forms of the shifts avoid a spurious -Wmaybe-uninitialized from
+    // the _mm512_undefined_epi32() inside the unmasked intrinsics.
+    const __mmask16 all=0xFFFF;
+
+    uint64_t res=0;
+    for(unsigned b=0; b<64; b+=16){
+      if( ((mask>>b)&0xFFFF)==0 ){
+        continue;
+      }
+      __m512i vPos=_mm512_add_epi32(_mm512_set1_epi32(pos+b), lane);
+      __m512i acc=_mm512_add_epi32(vPrefix, _mm512_mullo_epi32(vPos, k1));
+      acc=_mm512_maskz_rol_epi32(all, acc, 13);
+      acc=_mm512_mullo_epi32(acc, k2);
+
+      acc=_mm512_xor_si512(acc, _mm512_maskz_srli_epi32(all, acc, 15));
+      acc=_mm512_mullo_epi32(acc, k1);
+      acc=_mm512_xor_si512(acc, _mm512_maskz_srli_epi32(all, acc, 13));
+      acc=_mm512_mullo_epi32(acc, k3);
+      acc=_mm512_xor_si512(acc, _mm512_maskz_srli_epi32(all, acc, 16));
+
+      res |= uint64_t(_mm512_cmplt_epu32_mask(acc, vProb)) << b;
+    }
+    return res & mask;
+  }
+#endif
+
+  static bonds_fn_t select(std::string &name)
+  {
+    const char *force=getenv("HPCE_ISING_HRNG");
+#ifdef ISING_HRNG_X86
+    __builtin_cpu_init();
+    bool hasAvx512=__builtin_cpu_supports("avx512f");
+    bool hasAvx2=__builtin_cpu_supports("avx2");
+#else
+    bool hasAvx512=false, hasAvx2=false;
+#endif
+    if(force){
+      name=force;
+      if(name=="scalar"){
+        return bonds_scalar;
+      }
+#ifdef ISING_HRNG_X86
+      if(name=="avx2" && hasAvx2){
+        return bonds_avx2;
+      }
+      if(name=="avx512" && hasAvx512){
+        return bonds_avx512;
+      }
+#endif
+      throw std::runtime_error("IsingBondGenerator - HPCE_ISING_HRNG='"+name+"' is not supported on this machine.");
+    }
+#ifdef ISING_HRNG_X86
+    if(hasAvx512){
+      name="avx512";
+      return bonds_avx512;
+    }
+    if(hasAvx2){
+      name="avx2";
+      return bonds_avx2;
+    }
+#endif
+    name="scalar";
+    return bonds_scalar;
+  }
+
+public:
+  //! Returns the implementation chosen for this machine, and its name
+  static bonds_fn_t Implementation(std::string *pName=0)
+  {
+    static std::string name;
+    static bonds_fn_t fn=select(name);
+    if(pName){
+      *pName=name;
+    }
+    return fn;
+  }
+
+  IsingBondGenerator(uint32_t prefix, uint32_t prob)
+    : m_prefix(prefix)
+    , m_prob(prob)
+    , m_bonds(Implementation())
+  {}
+
+  //! Bit b is hrng(...,pos+b) < prob for every bit b set in mask, and zero elsewhere
+  uint64_t bonds(uint32_t pos, uint64_t mask) const
+  { return m_bonds(m_prefix, m_prob, pos, mask); }
+};
+
+#endif
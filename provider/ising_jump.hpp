@@ -0,0 +1,143 @@
+#ifndef user_ising_jump_hpp
+#define user_ising_jump_hpp
+
+#include "ising_tbb.hpp"
+
+/*
+  Keeps the reference label propagation, but follows every neighbour-min
+  sweep with a pointer-jumping pass, label[i]=label[label[i]]. A label is
+  always the index of a site in the same cluster with a label no larger
+  than its own, so the jump stays inside the cluster and can only lower the
+  label, and a run of k sites which already point down a chain collapses in
+  log k passes rather than k sweeps.
+
+  Both passes are data-parallel with no ordering requirements, which is the
+  same shape as the propagate kernel in ising.cl. Once a neighbour-min sweep
+  changes nothing every label is the cluster minimum, so the labels match
+  the reference exactly.
+
+  The number of sweeps is logged as "    jump sweeps %u", at the same level
+  and indent as the reference's "    diameter %u" and after the step's
+  "  create_clusters_jump %u", so with run_puzzle at verbose level the
+  engine's per-step counts and the reference's can be paired up by step
+  from one run without being mistaken for each other.
+*/
+class IsingJumpProvider
+  : public IsingTbbProvider
+{
+protected:
+  //! One in-place neighbour-min sweep, returning true if any label changed
+  bool propagate_tbb(unsigned n, const int *up_down, const int *left_right, label_t *cluster) const
+  {
+    return tbb::parallel_reduce(tbb::blocked_range<unsigned>(0, n), false, [&](const tbb::blocked_range<unsigned> &r, bool changed){
+      for(unsigned y=r.begin(); y<r.end(); y++){
+        unsigned yU=(y+1)%n, yD=(y+n-1)%n;
+        for(unsigned x=0; x<n; x++){
+          unsigned xR=(x+1)%n, xL=(x+n-1)%n;
+          unsigned prev=cluster[y*n+x].load(std::memory_order_relaxed);
+          unsigned curr=prev;
+          if(left_right[y*n+x]){
+            curr=std::min(curr, cluster[y*n+xR].load(std::memory_order_relaxed));
+          }
+          if(left_right[y*n+xL]){
+            curr=std::min(curr, cluster[y*n+xL].load(std::memory_order_relaxed));
+          }
+          if(up_down[y*n+x]){
+            curr=std::min(curr, cluster[yU*n+x].load(std::memory_order_relaxed));
+          }
+          if(up_down[yD*n+x]){
+            curr=std::min(curr, cluster[yD*n+x].load(std::memory_order_relaxed));
+          }
+          if(curr!=prev){
+            cluster[y*n+x].store(curr, std::memory_order_relaxed);
+            changed=true;
+          }
+        }
+      }
+      return changed;
+    }, std::logical_or<bool>());
+  }
+
+  void jump_tbb(unsigned n, label_t *cluster) const
+  {
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        unsigned label=cluster[i].load(std::memory_order_relaxed);
+        cluster[i].store(cluster[label].load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+    });
+  }
+
+  void create_clusters_jump(puzzler::ILog *log, unsigned n, unsigned step, const int *up_down, const int *left_right, label_t *cluster) const
+  {
+    log->LogVerbose("  create_clusters_jump %u", step);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        cluster[i].store(i, std::memory_order_relaxed);
+      }
+    });
+
+    unsigned sweeps=0;
+    while(1){
+      sweeps++;
+      if(!propagate_tbb(n, up_down, left_right, cluster)){
+        break;
+      }
+      jump_tbb(n, cluster);
+    }
+    log->LogVerbose("    jump sweeps %u", sweeps);
+  }
+
+public:
+  IsingJumpProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    WorkspacePool::Lease workspace(m_workspaces);
+    int *spins=workspace->get<int>(0, n*n);
+    int *left_right=workspace->get<int>(1, n*n);
+    int *up_down=workspace->get<int>(2, n*n);
+    label_t *clusters=workspace->get<label_t>(3, n*n);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        spins[i]=hrng(seed, rng_group_init, 0, i) & 1;
+      }
+    });
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_bonds_tbb", [&](){
+        create_bonds_tbb(log, n, seed, i, prob, spins, up_down, left_right);
+      });
+      timers.Run("create_clusters_jump", [&](){
+        create_clusters_jump(log, n, i, up_down, left_right, clusters);
+      });
+      timers.Run("flip_and_count_tbb", [&](){
+        stats[i]=flip_and_count_tbb(log, n, seed, i, clusters, spins);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef user_ising_opencl_hpp
+#define user_ising_opencl_hpp
+
+#include "ising_fused.hpp"
+
+#include "opencl_util.hpp"
+
+/*
+  Runs the whole simulation on the device. Only (n,seed,prob) go in as
+  kernel arguments, the initial spins are generated by a kernel, and the
+  spins, bonds and labels stay in device buffers for all n steps. The
+  history is accumulated on the device by the flip_and_count kernel and read
+  back once at the end.
+
+  Label propagation has a data-dependent number of sweeps, so the only other
+  transfer is a 4 byte "changed" flag, read after every batch of
+  sweeps_per_check sweeps. Each sweep is followed by a pointer-jumping pass,
+  which cuts the number of sweeps needed well below the cluster diameter.
+  Extra sweeps after convergence don't change anything, so overshooting by
+  part of a batch is harmless.
+
+  The program is built the first time the engine is used and then kept, as
+  building can take longer than a small puzzle. If there is no OpenCL
+  platform the puzzle is run by ising.fused on the host instead.
+*/
+class IsingOpenCLProvider
+  : public IsingFusedProvider
+{
+protected:
+  enum{ sweeps_per_check=8 };
+
+  mutable OpenCLProgramCache m_program;
+
+public:
+  IsingOpenCLProvider()
+    : m_program("ising.cl")
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    unsigned N=n*n;
+
+    OpenCLProgram *program=m_program.get(log);
+    if(!program){
+      IsingFusedProvider::Execute(log, pInput, pOutput);
+      return;
+    }
+    OpenCLProgram &cl=*program;
+
+    log->LogInfo("Building world");
+    cl::CommandQueue queue(cl.context, cl.device);
+
+    cl::Buffer spins(cl.context, CL_MEM_READ_WRITE, N);
+    cl::Buffer bonds(cl.context, CL_MEM_READ_WRITE, N);
+    cl::Buffer clusters(cl.context, CL_MEM_READ_WRITE, 4*N);
+    cl::Buffer changed(cl.context, CL_MEM_READ_WRITE, 4);
+    cl::Buffer history(cl.context, CL_MEM_READ_WRITE, 4*n);
+
+    cl::Kernel initKernel(cl.program, "init_spins");
+    initKernel.setArg(0, n);
+    initKernel.setArg(1, seed);
+    initKernel.setArg(2, spins);
+
+    cl::Kernel bondsKernel(cl.program, "create_bonds");
+    bondsKernel.setArg(0, n);
+    bondsKernel.setArg(1, seed);
+    bondsKernel.setArg(3, prob);
+    bondsKernel.setArg(4, spins);
+    bondsKernel.setArg(5, bonds);
+    bondsKernel.setArg(6, clusters);
+
+    cl::Kernel propagateKernel(cl.program, "propagate");
+    propagateKernel.setArg(0, n);
+    propagateKernel.setArg(1, bonds);
+    propagateKernel.setArg(2, clusters);
+    propagateKernel.setArg(3, changed);
+
+    cl::Kernel jumpKernel(cl.program, "jump");
+    jumpKernel.setArg(0, clusters);
+
+    cl::Kernel flipKernel(cl.program, "flip_and_count");
+    flipKernel.setArg(0, n);
+    flipKernel.setArg(1, seed);
+    flipKernel.setArg(3, clusters);
+    flipKernel.setArg(4, spins);
+    flipKernel.setArg(5, history);
+
+    cl::NDRange global(N);
+
+    queue.enqueueFillBuffer(history, cl_uint(0), 0, 4*n);
+    queue.enqueueNDRangeKernel(initKernel, cl::NullRange, global, cl::NullRange);
+
+    log->LogInfo("Doing iterations");
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+
+      bondsKernel.setArg(2, i);
+      queue.enqueueNDRangeKernel(bondsKernel, cl::NullRange, global, cl::NullRange);
+
+      unsigned sweeps=0;
+      cl_uint anyChanged=1;
+      while(anyChanged){
+        queue.enqueueFillBuffer(changed, cl_uint(0), 0, 4);
+        for(unsigned j=0; j<sweeps_per_check; j++){
+          queue.enqueueNDRangeKernel(propagateKernel, cl::NullRange, global, cl::NullRange);
+          queue.enqueueNDRangeKernel(jumpKernel, cl::NullRange, global, cl::NullRange);
+        }
+        sweeps+=sweeps_per_check;
+        queue.enqueueReadBuffer(changed, CL_TRUE, 0, 4, &anyChanged);
+      }
+      log->LogVerbose("    sweeps %u", sweeps);
+
+      flipKernel.setArg(2, i);
+      queue.enqueueNDRangeKernel(flipKernel, cl::NullRange, global, cl::NullRange);
+    }
+
+    std::vector<uint32_t> stats(n);
+    queue.enqueueReadBuffer(history, CL_TRUE, 0, 4*n, &stats[0]);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef user_ising_packed_hpp
+#define user_ising_packed_hpp
+
+#include "ising_tbb.hpp"
+#include "ising_hrng.hpp"
+
+/*
+  Keeps the spins and both bond arrays as bitplanes, with each row padded to
+  a whole number of 64-bit words (bit x of row y is bit x%64 of word
+  y*W+x/64). Bits past x=n-1 are always zero.
+
+  Neighbour disagreement becomes a word-wide xor: against the next row for
+  up_down, and against the row shifted right by one (with bit 0 wrapped round
+  to bit n-1) for left_right. Bonds are then generated a word at a time by
+  IsingBondGenerator and masked with the agreement bits, which matches the
+  reference only setting a bond when the spins agree.
+*/
+class IsingPackedProvider
+  : public IsingTbbProvider
+{
+protected:
+  unsigned words_per_row(unsigned n) const
+  { return (n+63)/64; }
+
+  //! Mask of the bits in word w of a row which correspond to real sites
+  uint64_t valid_mask(unsigned n, unsigned w) const
+  {
+    unsigned rem=n-w*64;
+    return rem>=64 ? ~uint64_t(0) : (uint64_t(1)<<rem)-1;
+  }
+
+  //! Bit x of the result is the spin at ((x+1)%n, y)
+  uint64_t right_neighbours(unsigned n, unsigned W, const uint64_t *row, unsigned w) const
+  {
+    uint64_t r=row[w]>>1;
+    if(w+1<W){
+      r |= row[w+1]<<63;
+    }else{
+      r |= (row[0]&1) << ((n-1)%64);
+    }
+    return r;
+  }
+
+  //! Hash state after the rounds of hrng that don't depend on pos
+  uint32_t hrng_prefix(uint32_t seed, uint32_t group, uint32_t iter) const
+  {
+    uint32_t acc=0;
+    acc=hround(acc,seed);
+    acc=hround(acc,group);
+    acc=hround(acc,iter);
+    return acc;
+  }
+
+  //! Word w of the up_down bonds for row y
+  uint64_t bonds_ud(unsigned n, unsigned W, const uint64_t *spins, unsigned y, unsigned w, const IsingBondGenerator &gen) const
+  {
+    const uint64_t *row=spins+y*W;
+    const uint64_t *rowU=spins+((y+1)%n)*W;
+    uint64_t agree=~(row[w]^rowU[w]) & valid_mask(n, w);
+    return gen.bonds(y*n+w*64, agree);
+  }
+
+  //! Word w of the left_right bonds for row y
+  uint64_t bonds_lr(unsigned n, unsigned W, const uint64_t *spins, unsigned y, unsigned w, const IsingBondGenerator &gen) const
+  {
+    const uint64_t *row=spins+y*W;
+    uint64_t agree=~(row[w]^right_neighbours(n, W, row, w)) & valid_mask(n, w);
+    return gen.bonds(y*n+w*64, agree);
+  }
+
+  void create_bonds_packed(puzzler::ILog *log, unsigned n, uint32_t seed, unsigned step, uint32_t prob, const uint64_t *spins, uint64_t *up_down, uint64_t *left_right) const
+  {
+    log->LogVerbose("  create_bonds_packed %u", step);
+
+    unsigned W=words_per_row(n);
+    IsingBondGenerator genUD(hrng_prefix(seed, rng_group_bond_ud, step), prob);
+    IsingBondGenerator genLR(hrng_prefix(seed, rng_group_bond_lr, step), prob);
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned y=r.begin(); y<r.end(); y++){
+        for(unsigned w=0; w<W; w++){
+          up_down[y*W+w]=bonds_ud(n, W, spins, y, w, genUD);
+          left_right[y*W+w]=bonds_lr(n, W, spins, y, w, genLR);
+        }
+      }
+    });
+  }
+
+  //! Same strip decomposition as create_clusters_strips, but only visits the set bond bits
+  void create_clusters_packed(puzzler::ILog *log, unsigned n, unsigned step, const uint64_t *up_down, const uint64_t *left_right, label_t *cluster) const
+  {
+    log->LogVerbose("  create_clusters_packed %u", step);
+
+    unsigned W=words_per_row(n);
+    unsigned strips=strip_count(n);
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y0=strip_begin(n, strips, k), y1=strip_begin(n, strips, k+1);
+      for(unsigned i=y0*n; i<y1*n; i++){
+        cluster[i].store(i, std::memory_order_relaxed);
+      }
+      for(unsigned y=y0; y<y1; y++){
+        for(unsigned w=0; w<W; w++){
+          uint64_t lr=left_right[y*W+w];
+          while(lr){
+            unsigned x=w*64+__builtin_ctzll(lr);
+            lr &= lr-1;
+            cuf_union(cluster, y*n+x, y*n+(x+1)%n);
+          }
+          if(y+1<y1){
+            uint64_t ud=up_down[y*W+w];
+            while(ud){
+              unsigned x=w*64+__builtin_ctzll(ud);
+              ud &= ud-1;
+              cuf_union(cluster, y*n+x, (y+1)*n+x);
+            }
+          }
+        }
+      }
+    });
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y=strip_begin(n, strips, k+1)-1;
+      for(unsigned w=0; w<W; w++){
+        uint64_t ud=up_down[y*W+w];
+        while(ud){
+          unsigned x=w*64+__builtin_ctzll(ud);
+          ud &= ud-1;
+          cuf_union(cluster, y*n+x, ((y+1)%n)*n+x);
+        }
+      }
+    });
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        cluster[i].store(cuf_find(cluster, i), std::memory_order_relaxed);
+      }
+    });
+  }
+
+  unsigned flip_and_count_packed(puzzler::ILog *log, unsigned n, uint32_t seed, unsigned step, label_t *clusters, uint64_t *spins) const
+  {
+    log->LogVerbose("  flip_and_count_packed %u", step);
+    check_flip_tag(n);
+
+    unsigned W=words_per_row(n);
+    return tbb::parallel_reduce(tbb::blocked_range<unsigned>(0, n), 0u, [&](const tbb::blocked_range<unsigned> &r, unsigned acc){
+      unsigned owned=r.begin()*n;
+      for(unsigned y=r.begin(); y<r.end(); y++){
+        for(unsigned w=0; w<W; w++){
+          unsigned begin=y*n+w*64, end=y*n+std::min(n, w*64+64);
+          uint64_t flips=0;
+          acc += flip_and_count_sites(seed, step, owned, begin, end, clusters, [&](unsigned i, bool flip){
+            flips |= uint64_t(flip) << (i-begin);
+          });
+          spins[y*W+w] ^= flips;
+        }
+      }
+      return acc;
+    }, std::plus<unsigned>());
+  }
+
+public:
+  IsingPackedProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    unsigned W=words_per_row(n);
+    WorkspacePool::Lease workspace(m_workspaces);
+    uint64_t *spins=workspace->get<uint64_t>(0, n*W);
+    uint64_t *left_right=workspace->get<uint64_t>(1, n*W);
+    uint64_t *up_down=workspace->get<uint64_t>(2, n*W);
+    label_t *clusters=workspace->get<label_t>(3, n*n);
+
+    std::string hrngName;
+    IsingBondGenerator::Implementation(&hrngName);
+    log->LogInfo("Using %s bond generator", hrngName.c_str());
+
+    tbb::parallel_for(0u, n, [&](unsigned y){
+      std::fill(spins+y*W, spins+(y+1)*W, 0);
+      for(unsigned x=0; x<n; x++){
+        spins[y*W+x/64] |= uint64_t(hrng(seed, rng_group_init, 0, y*n+x) & 1) << (x%64);
+      }
+    });
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_bonds_packed", [&](){
+        create_bonds_packed(log, n, seed, i, prob, spins, up_down, left_right);
+      });
+      timers.Run("create_clusters_packed", [&](){
+        create_clusters_packed(log, n, i, up_down, left_right, clusters);
+      });
+      timers.Run("flip_and_count_packed", [&](){
+        stats[i]=flip_and_count_packed(log, n, seed, i, clusters, spins);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef user_ising_tbb_hpp
+#define user_ising_tbb_hpp
+
+#include "ising_uf.hpp"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/blocked_range.h"
+#include "tbb/task_arena.h"
+
+/*
+  Parallel version of the union-find labelling. The torus is split into
+  strips of whole rows; each strip is labelled independently (horizontal
+  bonds, including the x wrap, never leave a strip), then the vertical bonds
+  crossing from the last row of each strip into the next strip (including the
+  wrap from row n-1 to row 0) are merged with a lock-free union-find.
+
+  Every value ever stored into a parent slot is an ancestor of that slot, and
+  links only go from a larger root to a smaller one, so relaxed atomics are
+  enough: a stale read just means a longer walk, and the roots are still the
+  minimum site index of each cluster.
+
+  The lattice buffers come from the workspace pool of ising.uf.
+*/
+class IsingTbbProvider
+  : public IsingUnionFindProvider
+{
+protected:
+  typedef std::atomic<unsigned> label_t;
+
+  //! Bond source which reads the arrays written by create_bonds
+  struct ArrayBonds
+  {
+    unsigned n;
+    const int *up_down;
+    const int *left_right;
+
+    bool ud(unsigned x, unsigned y) const
+    { return up_down[y*n+x]!=0; }
+
+    bool lr(unsigned x, unsigned y) const
+    { return left_right[y*n+x]!=0; }
+  };
+
+  unsigned cuf_find(label_t *parent, unsigned i) const
+  {
+    while(1){
+      unsigned p=parent[i].load(std::memory_order_relaxed);
+      if(p==i){
+        return i;
+      }
+      unsigned gp=parent[p].load(std::memory_order_relaxed);
+      if(gp!=p){
+        // Path halving. If it fails someone else already moved it further up.
+        parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      }
+      i=gp;
+    }
+  }
+
+  void cuf_union(label_t *parent, unsigned a, unsigned b) const
+  {
+    while(1){
+      a=cuf_find(parent, a);
+      b=cuf_find(parent, b);
+      if(a==b){
+        return;
+      }
+      if(a<b){
+        std::swap(a,b);
+      }
+      // Only succeeds if a is still a root; otherwise retry from the new roots
+      unsigned expected=a;
+      if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)){
+        return;
+      }
+    }
+  }
+
+  unsigned strip_count(unsigned n) const
+  {
+    unsigned strips=4*tbb::this_task_arena::max_concurrency();
+    return std::max(1u, std::min(n, strips));
+  }
+
+  //! First row of strip k, so strip k covers [strip_begin(k),strip_begin(k+1))
+  unsigned strip_begin(unsigned n, unsigned strips, unsigned k) const
+  {
+    return (unsigned)( (uint64_t(n)*k) / strips );
+  }
+
+  void create_bonds_tbb(puzzler::ILog *log, unsigned n, uint32_t seed, unsigned step, uint32_t prob, const int *spins, int *up_down, int *left_right) const
+  {
+    log->LogVerbose("  create_bonds_tbb %u", step);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned y=r.begin(); y<r.end(); y++){
+        for(unsigned x=0; x<n; x++){
+          bool sC=spins[y*n+x];
+
+          bool sU=spins[ ((y+1)%n)*n + x ];
+          if(sC!=sU){
+            up_down[y*n+x]=0;
+          }else{
+            up_down[y*n+x]=hrng(seed, rng_group_bond_ud, step, y*n+x) < prob;
+          }
+
+          bool sR=spins[ y*n + (x+1)%n ];
+          if(sC!=sR){
+            left_right[y*n+x]=0;
+          }else{
+            left_right[y*n+x]=hrng(seed, rng_group_bond_lr, step, y*n+x) < prob;
+          }
+        }
+      }
+    });
+  }
+
+  /*
+    Leaves cluster[i] holding the minimum site index of the cluster containing i.
+    TBonds must provide ud(x,y) and lr(x,y), which are the bonds from (x,y) to
+    (x,(y+1)%n) and ((x+1)%n,y) respectively.
+  */
+  template<class TBonds>
+  void create_clusters_strips(puzzler::ILog *log, unsigned n, unsigned step, const TBonds &bonds, label_t *cluster) const
+  {
+    log->LogVerbose("  create_clusters_strips %u", step);
+
+    unsigned strips=strip_count(n);
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y0=strip_begin(n, strips, k), y1=strip_begin(n, strips, k+1);
+      for(unsigned i=y0*n; i<y1*n; i++){
+        cluster[i].store(i, std::memory_order_relaxed);
+      }
+      for(unsigned y=y0; y<y1; y++){
+        for(unsigned x=0; x<n; x++){
+          if(bonds.lr(x,y)){
+            cuf_union(cluster, y*n+x, y*n+(x+1)%n);
+          }
+          if(y+1<y1 && bonds.ud(x,y)){
+            cuf_union(cluster, y*n+x, (y+1)*n+x);
+          }
+        }
+      }
+    });
+
+    tbb::parallel_for(0u, strips, [&](unsigned k){
+      unsigned y=strip_begin(n, strips, k+1)-1;
+      for(unsigned x=0; x<n; x++){
+        if(bonds.ud(x,y)){
+          cuf_union(cluster, y*n+x, ((y+1)%n)*n+x);
+        }
+      }
+    });
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        cluster[i].store(cuf_find(cluster, i), std::memory_order_relaxed);
+      }
+    });
+  }
+
+  //! Set in a root's label once the root has decided to flip
+  static const unsigned flip_tag=0x80000000u;
+
+  /*
+    Visits sites [begin,end), calling visit(i,flip), and returns the number
+    of roots seen. The caller owns [owned,end), and nobody else may touch
+    those labels while this runs.
+
+    The flip bit depends only on the root, so it is hashed once when the root
+    itself is visited and stored in the top bit of the root's label. Roots are
+    the smallest index in their cluster, so a root inside the owned range is
+    always visited before its members; roots owned by someone else are
+    hashed directly, with the last one cached as runs of equal labels are
+    common. Counting roots replaces the counts array of count_clusters.
+  */
+  template<class TVisit>
+  unsigned flip_and_count_sites(uint32_t seed, unsigned step, unsigned owned, unsigned begin, unsigned end, label_t *clusters, TVisit visit) const
+  {
+    unsigned count=0;
+    unsigned lastRoot=flip_tag;
+    bool lastFlip=false;
+    for(unsigned i=begin; i<end; i++){
+      unsigned label=clusters[i].load(std::memory_order_relaxed);
+      unsigned root=label & ~flip_tag;
+      bool flip;
+      if(root==i){
+        flip=hrng(seed, rng_group_flip, step, root) >> 31;
+        if(flip){
+          clusters[i].store(label|flip_tag, std::memory_order_relaxed);
+        }
+        count++;
+      }else if(root>=owned){
+        flip=clusters[root].load(std::memory_order_relaxed) >> 31;
+      }else{
+        if(root!=lastRoot){
+          lastRoot=root;
+          lastFlip=hrng(seed, rng_group_flip, step, root) >> 31;
+        }
+        flip=lastFlip;
+      }
+      visit(i, flip);
+    }
+    return count;
+  }
+
+  void check_flip_tag(unsigned n) const
+  {
+    if(uint64_t(n)*n > flip_tag){
+      throw std::runtime_error("IsingTbbProvider - lattice is too large for tagged labels.");
+    }
+  }
+
+  //! Replaces flip_clusters and count_clusters with one sweep
+  unsigned flip_and_count_tbb(puzzler::ILog *log, unsigned n, uint32_t seed, unsigned step, label_t *clusters, int *spins) const
+  {
+    log->LogVerbose("  flip_and_count_tbb %u", step);
+    check_flip_tag(n);
+
+    return tbb::parallel_reduce(tbb::blocked_range<unsigned>(0, n*n), 0u, [&](const tbb::blocked_range<unsigned> &r, unsigned acc){
+      return acc + flip_and_count_sites(seed, step, r.begin(), r.begin(), r.end(), clusters, [&](unsigned i, bool flip){
+        spins[i] ^= flip;
+      });
+    }, std::plus<unsigned>());
+  }
+
+public:
+  IsingTbbProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    WorkspacePool::Lease workspace(m_workspaces);
+    int *spins=workspace->get<int>(0, n*n);
+    int *left_right=workspace->get<int>(1, n*n);
+    int *up_down=workspace->get<int>(2, n*n);
+    label_t *clusters=workspace->get<label_t>(3, n*n);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n*n), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        spins[i]=hrng(seed, rng_group_init, 0, i) & 1;
+      }
+    });
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    ArrayBonds bonds={ n, up_down, left_right };
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_bonds_tbb", [&](){
+        create_bonds_tbb(log, n, seed, i, prob, spins, up_down, left_right);
+      });
+      timers.Run("create_clusters_strips", [&](){
+        create_clusters_strips(log, n, i, bonds, clusters);
+      });
+      timers.Run("flip_and_count_tbb", [&](){
+        stats[i]=flip_and_count_tbb(log, n, seed, i, clusters, spins);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
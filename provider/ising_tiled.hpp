@@ -0,0 +1,241 @@
+#ifndef user_ising_tiled_hpp
+#define user_ising_tiled_hpp
+
+#include "ising_tbb.hpp"
+
+/*
+  Stores the spins and labels in square tiles of tile_size x tile_size
+  sites, so the up and down neighbours of a site are a tile row away rather
+  than a lattice row away. Tile (tx,ty) occupies slots
+  [(ty*tiles+tx)*tile_sites, +tile_sites), row-major within the tile. The
+  tiles on the right and top edges are partial when n is not a multiple of
+  tile_size; their padding slots are never touched.
+
+  Each tile is labelled on its own with the bonds that stay inside it, then
+  the bonds leaving its last column and last row (which include the periodic
+  wrap) are merged as a halo pass with the lock-free union-find. The
+  row-major index y*n+x is only recovered where the results depend on it:
+  as the pos of the hashes, and as the ordering of roots, so that each root
+  is still the site with the smallest row-major index in its cluster.
+*/
+class IsingTiledProvider
+  : public IsingTbbProvider
+{
+protected:
+  enum{
+    tile_log=6,
+    tile_size=1<<tile_log,
+    tile_sites=tile_size*tile_size
+  };
+
+  struct TiledLayout
+  {
+    unsigned n;
+    unsigned tiles;              // Tiles along each side
+    std::vector<unsigned> base;  // Row-major index of the first site of each tile
+
+    TiledLayout(unsigned _n)
+      : n(_n)
+      , tiles((_n+tile_size-1)/tile_size)
+      , base(tiles*tiles)
+    {
+      for(unsigned t=0; t<tiles*tiles; t++){
+        base[t]=(t/tiles)*tile_size*n + (t%tiles)*tile_size;
+      }
+    }
+
+    unsigned slots() const
+    { return tiles*tiles*tile_sites; }
+
+    unsigned width(unsigned t) const
+    { return std::min<unsigned>(tile_size, n-(t%tiles)*tile_size); }
+
+    unsigned height(unsigned t) const
+    { return std::min<unsigned>(tile_size, n-(t/tiles)*tile_size); }
+
+    unsigned index(unsigned x, unsigned y) const
+    {
+      unsigned t=(y>>tile_log)*tiles + (x>>tile_log);
+      return (t<<(2*tile_log)) + ((y&(tile_size-1))<<tile_log) + (x&(tile_size-1));
+    }
+
+    //! Row-major index of the site in slot s
+    unsigned key(unsigned s) const
+    {
+      unsigned off=s&(tile_sites-1);
+      return base[s>>(2*tile_log)] + (off>>tile_log)*n + (off&(tile_size-1));
+    }
+  };
+
+  //! As cuf_union, but roots are ordered by row-major index rather than slot
+  void tuf_union(const TiledLayout &layout, label_t *parent, unsigned a, unsigned b) const
+  {
+    while(1){
+      a=cuf_find(parent, a);
+      b=cuf_find(parent, b);
+      if(a==b){
+        return;
+      }
+      if(layout.key(a)<layout.key(b)){
+        std::swap(a,b);
+      }
+      unsigned expected=a;
+      if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)){
+        return;
+      }
+    }
+  }
+
+  //! Bond from slot s (site key) to slot sN, following create_bonds
+  bool bond(uint32_t seed, unsigned group, unsigned step, uint32_t prob, const uint8_t *spins, unsigned s, unsigned key, unsigned sN) const
+  {
+    return spins[s]==spins[sN] && hrng(seed, group, step, key) < prob;
+  }
+
+  void create_clusters_tiled(puzzler::ILog *log, const TiledLayout &layout, uint32_t seed, unsigned step, uint32_t prob, const uint8_t *spins, label_t *cluster) const
+  {
+    log->LogVerbose("  create_clusters_tiled %u", step);
+
+    unsigned n=layout.n;
+    unsigned nTiles=layout.tiles*layout.tiles;
+
+    tbb::parallel_for(0u, nTiles, [&](unsigned t){
+      unsigned w=layout.width(t), h=layout.height(t);
+      unsigned s0=t*tile_sites;
+      for(unsigned ly=0; ly<h; ly++){
+        for(unsigned lx=0; lx<w; lx++){
+          unsigned s=s0+ly*tile_size+lx;
+          cluster[s].store(s, std::memory_order_relaxed);
+        }
+      }
+      for(unsigned ly=0; ly<h; ly++){
+        unsigned key=layout.base[t]+ly*n;
+        for(unsigned lx=0; lx<w; lx++, key++){
+          unsigned s=s0+ly*tile_size+lx;
+          if(lx+1<w && bond(seed, rng_group_bond_lr, step, prob, spins, s, key, s+1)){
+            tuf_union(layout, cluster, s, s+1);
+          }
+          if(ly+1<h && bond(seed, rng_group_bond_ud, step, prob, spins, s, key, s+tile_size)){
+            tuf_union(layout, cluster, s, s+tile_size);
+          }
+        }
+      }
+    });
+
+    // Halo: the last column and last row of each tile, including the wrap
+    tbb::parallel_for(0u, nTiles, [&](unsigned t){
+      unsigned w=layout.width(t), h=layout.height(t);
+      unsigned x0=(t%layout.tiles)*tile_size, y0=(t/layout.tiles)*tile_size;
+      for(unsigned ly=0; ly<h; ly++){
+        unsigned x=x0+w-1, y=y0+ly;
+        unsigned s=layout.index(x, y), sN=layout.index((x+1)%n, y);
+        if(bond(seed, rng_group_bond_lr, step, prob, spins, s, y*n+x, sN)){
+          tuf_union(layout, cluster, s, sN);
+        }
+      }
+      for(unsigned lx=0; lx<w; lx++){
+        unsigned x=x0+lx, y=y0+h-1;
+        unsigned s=layout.index(x, y), sN=layout.index(x, (y+1)%n);
+        if(bond(seed, rng_group_bond_ud, step, prob, spins, s, y*n+x, sN)){
+          tuf_union(layout, cluster, s, sN);
+        }
+      }
+    });
+  }
+
+  /*
+    Finds the root of every site, flips and counts in one pass per tile.
+    Slot order within a tile follows row-major order, so a root in the same
+    tile is always visited before its members and its flip can be looked up
+    from a per-tile table; roots in other tiles are hashed, caching the last.
+  */
+  unsigned flip_and_count_tiled(puzzler::ILog *log, const TiledLayout &layout, uint32_t seed, unsigned step, label_t *cluster, uint8_t *spins) const
+  {
+    log->LogVerbose("  flip_and_count_tiled %u", step);
+
+    unsigned nTiles=layout.tiles*layout.tiles;
+    return tbb::parallel_reduce(tbb::blocked_range<unsigned>(0, nTiles), 0u, [&](const tbb::blocked_range<unsigned> &r, unsigned acc){
+      uint8_t flips[tile_sites];
+      for(unsigned t=r.begin(); t<r.end(); t++){
+        unsigned w=layout.width(t), h=layout.height(t);
+        unsigned s0=t*tile_sites;
+        unsigned lastRoot=~0u;
+        bool lastFlip=false;
+        for(unsigned ly=0; ly<h; ly++){
+          for(unsigned lx=0; lx<w; lx++){
+            unsigned s=s0+ly*tile_size+lx;
+            unsigned root=cuf_find(cluster, s);
+            bool flip;
+            if(root==s){
+              flip=hrng(seed, rng_group_flip, step, layout.key(s)) >> 31;
+              acc++;
+            }else if(root-s0 < tile_sites){
+              flip=flips[root-s0];
+            }else{
+              if(root!=lastRoot){
+                lastRoot=root;
+                lastFlip=hrng(seed, rng_group_flip, step, layout.key(root)) >> 31;
+              }
+              flip=lastFlip;
+            }
+            flips[s-s0]=flip;
+            spins[s] ^= flip;
+          }
+        }
+      }
+      return acc;
+    }, std::plus<unsigned>());
+  }
+
+public:
+  IsingTiledProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    TiledLayout layout(n);
+    WorkspacePool::Lease workspace(m_workspaces);
+    uint8_t *spins=workspace->get<uint8_t>(0, layout.slots());
+    label_t *clusters=workspace->get<label_t>(1, layout.slots());
+
+    // Zero the padding at the edges of partial tiles as well
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, layout.slots()), [&](const tbb::blocked_range<unsigned> &r){
+      std::fill(spins+r.begin(), spins+r.end(), 0);
+    });
+    tbb::parallel_for(0u, n, [&](unsigned y){
+      for(unsigned x=0; x<n; x++){
+        spins[layout.index(x,y)]=hrng(seed, rng_group_init, 0, y*n+x) & 1;
+      }
+    });
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_clusters_tiled", [&](){
+        create_clusters_tiled(log, layout, seed, i, prob, spins, clusters);
+      });
+      timers.Run("flip_and_count_tiled", [&](){
+        stats[i]=flip_and_count_tiled(log, layout, seed, i, clusters, spins);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef user_ising_uf_hpp
+#define user_ising_uf_hpp
+
+#include "puzzler/puzzles/ising.hpp"
+
+#include "phase_timer.hpp"
+#include "workspace.hpp"
+
+/*
+  Replaces the label propagation in create_clusters with a union-find
+  (Hoshen-Kopelman style) pass. The reference sweeps until no label changes,
+  which is O(n^2 * diameter); this is a single sweep over the bonds plus a
+  single sweep to flatten the forest.
+
+  A union always links the larger root under the smaller one, so the root of
+  every set is the smallest site index in it, and every parent pointer points
+  at a smaller index. Flattening in increasing index order therefore gives
+  exactly the minimum-index labels that the reference converges to.
+
+  The lattice buffers come from a per-thread workspace kept by the engine
+  (see workspace.hpp), so back-to-back calls reuse the same pages. This
+  engine and the ones derived from it share the pool.
+*/
+class IsingUnionFindProvider
+  : public puzzler::IsingPuzzle
+{
+protected:
+  mutable WorkspacePool m_workspaces;
+
+  unsigned uf_find(unsigned *parent, unsigned i) const
+  {
+    while(parent[i]!=i){
+      parent[i]=parent[parent[i]]; // Path halving
+      i=parent[i];
+    }
+    return i;
+  }
+
+  void uf_union(unsigned *parent, unsigned a, unsigned b) const
+  {
+    a=uf_find(parent, a);
+    b=uf_find(parent, b);
+    if(a<b){
+      parent[b]=a;
+    }else if(b<a){
+      parent[a]=b;
+    }
+  }
+
+  //! Turn a forest where parent[i]<=i into root labels with one ordered sweep
+  void uf_flatten(unsigned begin, unsigned end, unsigned *parent) const
+  {
+    for(unsigned i=begin; i<end; i++){
+      parent[i]=parent[parent[i]];
+    }
+  }
+
+  void create_clusters_uf(puzzler::ILog *log, unsigned n, unsigned step, const int *up_down, const int *left_right, unsigned *cluster) const
+  {
+    log->LogVerbose("  create_clusters_uf %u", step);
+
+    for(unsigned i=0; i<n*n; i++){
+      cluster[i]=i;
+    }
+
+    for(unsigned y=0; y<n; y++){
+      for(unsigned x=0; x<n; x++){
+        if(left_right[y*n+x]){
+          uf_union(cluster, y*n+x, y*n+(x+1)%n);
+        }
+        if(up_down[y*n+x]){
+          uf_union(cluster, y*n+x, ((y+1)%n)*n+x);
+        }
+      }
+    }
+
+    uf_flatten(0, n*n, cluster);
+  }
+
+public:
+  IsingUnionFindProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::IsingInput *pInput,
+         puzzler::IsingOutput *pOutput
+         ) const override
+  {
+    PhaseTimers timers;
+    log->LogInfo("Building world");
+    unsigned n=pInput->n;
+    uint32_t prob=pInput->prob;
+    uint32_t seed=pInput->seed;
+    WorkspacePool::Lease workspace(m_workspaces);
+    int *spins=workspace->get<int>(0, n*n);
+    int *left_right=workspace->get<int>(1, n*n);
+    int *up_down=workspace->get<int>(2, n*n);
+    unsigned *clusters=workspace->get<unsigned>(3, n*n);
+    unsigned *counts=workspace->get<unsigned>(4, n*n);
+    for(unsigned i=0; i<n*n; i++){
+      spins[i]=hrng(seed, rng_group_init, 0, i) & 1;
+    }
+
+    log->LogInfo("Doing iterations");
+    std::vector<uint32_t> stats(n);
+
+    for(unsigned i=0; i<n; i++){
+      log->LogVerbose("  Iteration %u", i);
+      timers.Run("create_bonds", [&](){
+        create_bonds(log, n, seed, i, prob, spins, up_down, left_right);
+      });
+      timers.Run("create_clusters_uf", [&](){
+        create_clusters_uf(log, n, i, up_down, left_right, clusters);
+      });
+      timers.Run("flip_clusters", [&](){
+        flip_clusters(log, n, seed, i, clusters, spins);
+      });
+      timers.Run("count_clusters", [&](){
+        count_clusters(log, n, seed, i, clusters, counts, stats[i]);
+      });
+      log->LogVerbose("  clusters count is %u", stats[i]);
+    }
+    timers.Report(log);
+
+    pOutput->history=stats;
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef user_opencl_util_hpp
+#define user_opencl_util_hpp
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "puzzler/core/log.hpp"
+
+/*
+  Device selection and program building shared by the OpenCL engines.
+
+  The platform and device default to the first ones found, and can be chosen
+  with HPCE_SELECT_PLATFORM and HPCE_SELECT_DEVICE. Any device type is
+  accepted, so a CPU-only runtime such as POCL works. Kernel sources are
+  loaded at runtime from HPCE_CL_SRC_DIR, which defaults to "provider" as the
+  programs are run from the root of the repository.
+
+  If there is no OpenCL platform or device at all (for example the ICD
+  loader is installed but no driver is registered with it) OpenCLProgram
+  throws OpenCLUnavailable. OpenCLProgramCache turns that into a null
+  program, so the engines can log it and run on the host instead. Any other
+  failure, such as a kernel that doesn't build, is still an error.
+*/
+
+//! Thrown by OpenCLProgram when there is no OpenCL platform or device to use
+class OpenCLUnavailable
+  : public std::runtime_error
+{
+public:
+  OpenCLUnavailable(const std::string &msg)
+    : std::runtime_error(msg)
+  {}
+};
+
+class OpenCLProgram
+{
+private:
+  static int select_index(const char *envName, unsigned count, const char *what)
+  {
+    int index=0;
+    if(getenv(envName)){
+      index=atoi(getenv(envName));
+    }
+    if(index<0 || unsigned(index)>=count){
+      throw std::runtime_error(std::string("OpenCLProgram - no ")+what+" at the selected index.");
+    }
+    return index;
+  }
+
+  static std::string load_source(const std::string &fileName)
+  {
+    std::string dir="provider";
+    if(getenv("HPCE_CL_SRC_DIR")){
+      dir=getenv("HPCE_CL_SRC_DIR");
+    }
+    std::string path=dir+"/"+fileName;
+
+    std::ifstream src(path.c_str(), std::ios::in | std::ios::binary);
+    if(!src.is_open()){
+      throw std::runtime_error("OpenCLProgram - couldn't load kernel source from '"+path+"'.");
+    }
+    return std::string(std::istreambuf_iterator<char>(src), std::istreambuf_iterator<char>());
+  }
+
+public:
+  cl::Device device;
+  cl::Context context;
+  cl::Program program;
+
+  OpenCLProgram(puzzler::ILog *log, const std::string &fileName, const std::string &options="")
+  {
+    std::vector<cl::Platform> platforms;
+    try{
+      cl::Platform::get(&platforms);
+    }catch(cl::Error &e){
+      // ICD loaders return CL_PLATFORM_NOT_FOUND_KHR (-1001) when no driver is registered
+      throw OpenCLUnavailable(std::string("OpenCLProgram - ")+e.what()+" failed with error "+std::to_string(e.err())+".");
+    }
+    if(platforms.size()==0){
+      throw OpenCLUnavailable("OpenCLProgram - no OpenCL platforms found.");
+    }
+    cl::Platform platform=platforms[select_index("HPCE_SELECT_PLATFORM", platforms.size(), "platform")];
+    log->LogInfo("Using OpenCL platform '%s'", platform.getInfo<CL_PLATFORM_NAME>().c_str());
+
+    std::vector<cl::Device> devices;
+    try{
+      platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    }catch(cl::Error &e){
+      // CL_DEVICE_NOT_FOUND
+      throw OpenCLUnavailable(std::string("OpenCLProgram - ")+e.what()+" failed with error "+std::to_string(e.err())+".");
+    }
+    if(devices.size()==0){
+      throw OpenCLUnavailable("OpenCLProgram - no OpenCL devices found.");
+    }
+    device=devices[select_index("HPCE_SELECT_DEVICE", devices.size(), "device")];
+    log->LogInfo("Using OpenCL device '%s'", device.getInfo<CL_DEVICE_NAME>().c_str());
+
+    std::vector<cl::Device> selected(1, device);
+    context=cl::Context(selected);
+
+    std::string source=load_source(fileName);
+    cl::Program::Sources sources;
+    sources.push_back(std::make_pair(source.c_str(), source.size()));
+    program=cl::Program(context, sources);
+    try{
+      program.build(selected, options.c_str());
+    }catch(cl::Error &){
+      log->LogError("Build log for %s:\n%s", fileName.c_str(), program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device).c_str());
+      throw;
+    }
+  }
+};
+
+//! Builds an engine's program the first time it is needed, and keeps it
+class OpenCLProgramCache
+{
+private:
+  std::string m_fileName;
+  std::mutex m_mutex;
+  std::unique_ptr<OpenCLProgram> m_program;
+  std::string m_unavailable;
+
+public:
+  OpenCLProgramCache(const std::string &fileName)
+    : m_fileName(fileName)
+  {}
+
+  //! The program, or null (after logging why) if there is no OpenCL platform or device
+  OpenCLProgram *get(puzzler::ILog *log)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_program && m_unavailable.empty()){
+      try{
+        m_program.reset(new OpenCLProgram(log, m_fileName));
+      }catch(OpenCLUnavailable &e){
+        m_unavailable=e.what();
+      }
+    }
+    if(!m_program){
+      log->LogInfo("%s Running on the host instead.", m_unavailable.c_str());
+    }
+    return m_program.get();
+  }
+};
+
+#endif
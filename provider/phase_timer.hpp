@@ -0,0 +1,110 @@
+#ifndef user_phase_timer_hpp
+#define user_phase_timer_hpp
+
+#include "puzzler/core/log.hpp"
+#include "puzzler/core/util.hpp"
+
+#include <stdexcept>
+
+/*
+  Accumulates wall-clock time and call counts per named phase of an engine,
+  and logs a summary table. Engines create one on the stack in Execute and
+  wrap each phase:
+
+    PhaseTimers timers;
+    ...
+    timers.Run("create_bonds", [&](){ create_bonds(...); });
+    ...
+    timers.Report(log);
+
+  Phases are timed with puzzler::now(), and a phase name is identified by its
+  pointer, so use string literals. The object is not thread-safe; phases are
+  expected to be started from the thread running Execute (they can be
+  parallel inside).
+
+  Timing is only compiled in when HPCE_PHASE_TIMERS is defined (see
+  provider/makefile). Otherwise Run just calls the phase and Report does
+  nothing, so the instrumentation costs nothing.
+*/
+#ifdef HPCE_PHASE_TIMERS
+
+class PhaseTimers
+{
+private:
+  enum{ max_phases=16 };
+
+  struct Phase
+  {
+    const char *name;
+    uint64_t ns;
+    uint64_t calls;
+  };
+
+  Phase m_phases[max_phases];
+  unsigned m_count;
+  puzzler::timestamp_t m_begin;
+
+  Phase &lookup(const char *name)
+  {
+    for(unsigned i=0; i<m_count; i++){
+      if(m_phases[i].name==name){
+        return m_phases[i];
+      }
+    }
+    if(m_count==max_phases){
+      throw std::runtime_error("PhaseTimers - too many phases.");
+    }
+    m_phases[m_count]=Phase{name, 0, 0};
+    return m_phases[m_count++];
+  }
+
+public:
+  PhaseTimers()
+    : m_count(0)
+    , m_begin(puzzler::now())
+  {}
+
+  template<class TPhase>
+  void Run(const char *name, TPhase phase)
+  {
+    puzzler::timestamp_t start=puzzler::now();
+    phase();
+    Phase &p=lookup(name);
+    p.ns += puzzler::now()-start;
+    p.calls++;
+  }
+
+  //! Logs one line per phase, in order of first use, plus the untimed remainder
+  void Report(puzzler::ILog *log) const
+  {
+    uint64_t total=puzzler::now()-m_begin;
+    uint64_t timed=0;
+    log->LogInfo("Phase timings:");
+    log->LogInfo("  %-24s %12s %8s %12s %6s", "phase", "total ms", "calls", "us/call", "%");
+    for(unsigned i=0; i<m_count; i++){
+      const Phase &p=m_phases[i];
+      timed += p.ns;
+      log->LogInfo("  %-24s %12.3f %8llu %12.3f %6.1f", p.name, p.ns*1e-6, (unsigned long long)p.calls,
+        p.ns*1e-3/p.calls, total ? 100.0*p.ns/total : 0.0);
+    }
+    uint64_t other=total>timed ? total-timed : 0;
+    log->LogInfo("  %-24s %12.3f %8s %12s %6.1f", "(untimed)", other*1e-6, "", "", total ? 100.0*other/total : 0.0);
+  }
+};
+
+#else
+
+class PhaseTimers
+{
+public:
+  template<class TPhase>
+  void Run(const char *, TPhase phase)
+  { phase(); }
+
+  void Report(puzzler::ILog *) const
+  {}
+};
+
+#endif
+
+#endif
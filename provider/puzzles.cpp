@@ -7,6 +7,24 @@
 #include "integral.hpp"
 
 // TODO: include your engine headers
+#include "ising_uf.hpp"
+#include "ising_tbb.hpp"
+#include "ising_packed.hpp"
+#include "ising_fused.hpp"
+#include "ising_jump.hpp"
+#include "ising_batch.hpp"
+#include "ising_tiled.hpp"
+#include "rank_csr.hpp"
+#include "rank_tbb.hpp"
+#include "rank_fused.hpp"
+#include "rank_reorder.hpp"
+#include "rank_binned.hpp"
+#include "rank_extrap.hpp"
+#include "rank_mixed.hpp"
+#include "rank_gs.hpp"
+#include "rank_skip.hpp"
+#include "ising_opencl.hpp"
+#include "rank_opencl.hpp"
 
 void puzzler::PuzzleRegistrar::UserRegisterPuzzles()
 {
@@ -16,6 +34,24 @@ void puzzler::PuzzleRegistrar::UserRegisterPuzzles()
   Register("rank.ref", std::make_shared<puzzler::RankPuzzle>());
 
   // TODO: Register more engines!
+  Register("ising.uf", std::make_shared<IsingUnionFindProvider>());
+  Register("ising.tbb", std::make_shared<IsingTbbProvider>());
+  Register("ising.packed", std::make_shared<IsingPackedProvider>());
+  Register("ising.fused", std::make_shared<IsingFusedProvider>());
+  Register("ising.jump", std::make_shared<IsingJumpProvider>());
+  Register("ising.batch", std::make_shared<IsingBatchProvider>());
+  Register("ising.tiled", std::make_shared<IsingTiledProvider>());
+  Register("rank.csr", std::make_shared<RankCsrProvider>());
+  Register("rank.tbb", std::make_shared<RankTbbProvider>());
+  Register("rank.fused", std::make_shared<RankFusedProvider>());
+  Register("rank.reorder", std::make_shared<RankReorderProvider>());
+  Register("rank.binned", std::make_shared<RankBinnedProvider>());
+  Register("rank.extrap", std::make_shared<RankExtrapolatedProvider>());
+  Register("rank.mixed", std::make_shared<RankMixedProvider>());
+  Register("rank.gs", std::make_shared<RankGaussSeidelProvider>());
+  Register("rank.skip", std::make_shared<RankSkipProvider>());
+  Register("ising.opencl", std::make_shared<IsingOpenCLProvider>());
+  Register("rank.opencl", std::make_shared<RankOpenCLProvider>());
 
   // Note that you can register the same engine twice under different names, for
   // example you could register the same engine for "ising.tbb" and "ising.opt"
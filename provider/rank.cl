@@ -0,0 +1,122 @@
+/*
+  Kernels for RankOpenCLProvider. The graph is the in-edge CSR from
+  RankCsr::transposed(): the sources of the edges into v are
+  sources[offsets[v]] to sources[offsets[v+1]-1]. contrib[u] is
+  curr[u]*inv_degree[u], written by rank_normalise at the end of the
+  previous iteration.
+
+  Every kernel is launched with a power-of-two work-group size, and gets a
+  __local scratch array of one float per work-item for its reductions.
+*/
+
+//! Sum of value over the work-group, returned to every work-item
+float group_sum(__local float *scratch, float value)
+{
+  uint lid=get_local_id(0), size=get_local_size(0);
+
+  barrier(CLK_LOCAL_MEM_FENCE);   // Earlier readers of scratch are done
+  scratch[lid]=value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(uint s=size/2; s>0; s>>=1){
+    if(lid<s){
+      scratch[lid] += scratch[lid+s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  return scratch[0];
+}
+
+//! One work-item per vertex; partials[g] gets the total of next over work-group g
+__kernel void rank_gather_vertex(uint n, __global const uint *offsets, __global const uint *sources, __global const float *curr, __global const float *contrib, __global float *next, __global float *partials, __local float *scratch)
+{
+  uint v=get_global_id(0);
+
+  float y=0;
+  if(v<n){
+    float acc=0;
+    for(uint j=offsets[v]; j<offsets[v+1]; j++){
+      acc += contrib[sources[j]];
+    }
+    y=curr[v]*0.3f + acc*0.7f;
+    next[v]=y;
+  }
+
+  float total=group_sum(scratch, y);
+  if(get_local_id(0)==0){
+    partials[get_group_id(0)]=total;
+  }
+}
+
+//! lanes consecutive work-items per vertex, striding along its sources
+__kernel void rank_gather_row(uint n, uint lanes, __global const uint *offsets, __global const uint *sources, __global const float *curr, __global const float *contrib, __global float *next, __global float *partials, __local float *scratch)
+{
+  uint lid=get_local_id(0);
+  uint lane=lid%lanes;
+  uint v=get_global_id(0)/lanes;
+
+  float acc=0;
+  if(v<n){
+    for(uint j=offsets[v]+lane; j<offsets[v+1]; j+=lanes){
+      acc += contrib[sources[j]];
+    }
+  }
+  scratch[lid]=acc;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(uint s=lanes/2; s>0; s>>=1){
+    if(lane<s){
+      scratch[lid] += scratch[lid+s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  float y=0;
+  if(lane==0 && v<n){
+    y=curr[v]*0.3f + scratch[lid]*0.7f;
+    next[v]=y;
+  }
+
+  float total=group_sum(scratch, y);
+  if(lid==0){
+    partials[get_group_id(0)]=total;
+  }
+}
+
+/*
+  Normalises next by total[0] (the sum of the gather partials, from
+  rank_reduce), writes the contributions for the next iteration, and
+  leaves |next-curr|^2 over work-group g in distPartials[g].
+*/
+__kernel void rank_normalise(uint n, __global const float *total, __global const float *curr, __global float *next, __global const float *inv_degree, __global float *contrib, __global float *distPartials, __local float *scratch)
+{
+  float t=total[0];
+
+  uint i=get_global_id(0);
+  float d2=0;
+  if(i<n){
+    float x=next[i]/t;
+    next[i]=x;
+    contrib[i]=x*inv_degree[i];
+    float d=x-curr[i];
+    d2=d*d;
+  }
+
+  float dist2=group_sum(scratch, d2);
+  if(get_local_id(0)==0){
+    distPartials[get_group_id(0)]=dist2;
+  }
+}
+
+//! Run as a single work-group: result[0] = sum of partials[0..count)
+__kernel void rank_reduce(uint count, __global const float *partials, __global float *result, __local float *scratch)
+{
+  uint lid=get_local_id(0), size=get_local_size(0);
+
+  float t=0;
+  for(uint g=lid; g<count; g+=size){
+    t += partials[g];
+  }
+  float total=group_sum(scratch, t);
+  if(lid==0){
+    result[0]=total;
+  }
+}
@@ -0,0 +1,201 @@
+#ifndef user_rank_binned_hpp
+#define user_rank_binned_hpp
+
+#include "rank_tbb.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/*
+  Propagation blocking. The push loop of the reference does one random
+  read-modify-write of next[dst] per edge, which misses once next no longer
+  fits in cache. Here the destinations are split into bins of width
+  vertices, sized so that a bin's slice of next fits in half the L2, and
+  each iteration runs in two phases:
+
+    1. Walk the sources in order and append each edge's contribution to the
+       bin of its destination. Each bin is a sequential write stream.
+    2. For each bin, add its contributions into its slice of next, which
+       stays in cache, then blend and sum the slice.
+
+  The graph doesn't change, so the destination of every binned slot is
+  written once up front and phase 1 only streams the float values. The
+  sources are cut into fixed chunks that append to their own part of each
+  bin, laid out bin-major then chunk, so a bin lists its contributions in
+  increasing source order and next[v] is summed in the same order as the
+  reference.
+
+  The cache size comes from sysconf, then sysfs, and can be overridden
+  with HPCE_RANK_BIN_BYTES.
+*/
+class RankBinnedProvider
+  : public RankTbbProvider
+{
+protected:
+  enum{ bin_min_width=1024 };
+
+  static size_t detect_cache_bytes()
+  {
+    if(getenv("HPCE_RANK_BIN_BYTES")){
+      return strtoul(getenv("HPCE_RANK_BIN_BYTES"), 0, 0);
+    }
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long fromSysconf=sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if(fromSysconf>0){
+      return fromSysconf;
+    }
+#endif
+    size_t fromSysfs=0;
+    if(FILE *f=fopen("/sys/devices/system/cpu/cpu0/cache/index2/size", "r")){
+      unsigned long size;
+      char unit=0;
+      if(fscanf(f, "%lu%c", &size, &unit)>=1){
+        fromSysfs=size * (unit=='K' ? 1024 : unit=='M' ? 1024*1024 : 1);
+      }
+      fclose(f);
+    }
+    return fromSysfs ? fromSysfs : 256*1024;
+  }
+
+  struct RankBins
+  {
+    unsigned shift;     // Destination v goes in bin v>>shift
+    unsigned bins;
+    unsigned chunks;    // Sources [c*rank_grain,(c+1)*rank_grain) are chunk c
+    std::vector<uint32_t> starts;   // Part (b,c) is [starts[b*chunks+c], starts[b*chunks+c+1])
+    std::vector<uint32_t> dest;     // Destination of each binned slot
+  };
+
+  RankBins make_bins(const RankCsr &out, size_t cacheBytes) const
+  {
+    unsigned n=out.n;
+    const uint32_t *offsets=&out.offsets[0];
+    const uint32_t *targets=out.targets.empty() ? 0 : &out.targets[0];
+
+    RankBins bins;
+    bins.shift=0;
+    while( (size_t(2)<<bins.shift)*sizeof(float) <= cacheBytes/2 ){
+      bins.shift++;
+    }
+    while( (1u<<bins.shift) < bin_min_width ){
+      bins.shift++;
+    }
+    bins.bins=std::max(1u, (n+(1u<<bins.shift)-1)>>bins.shift);
+    bins.chunks=std::max(1u, (n+rank_grain-1)/rank_grain);
+
+    unsigned B=bins.bins, C=bins.chunks;
+    bins.starts.assign(B*C+1, 0);
+    tbb::parallel_for(0u, C, [&](unsigned c){
+      unsigned end=std::min(n, (c+1)*rank_grain);
+      for(unsigned j=offsets[c*rank_grain]; j<offsets[end]; j++){
+        bins.starts[(targets[j]>>bins.shift)*C+c+1]++;
+      }
+    });
+    for(unsigned i=0; i<B*C; i++){
+      bins.starts[i+1]+=bins.starts[i];
+    }
+
+    bins.dest.resize(out.targets.size());
+    tbb::parallel_for(0u, C, [&](unsigned c){
+      std::vector<uint32_t> cursor(B);
+      for(unsigned b=0; b<B; b++){
+        cursor[b]=bins.starts[b*C+c];
+      }
+      unsigned end=std::min(n, (c+1)*rank_grain);
+      for(unsigned j=offsets[c*rank_grain]; j<offsets[end]; j++){
+        bins.dest[cursor[targets[j]>>bins.shift]++]=targets[j];
+      }
+    });
+    return bins;
+  }
+
+  //! One reference iteration with the scatter done through the bins; values must hold one float per edge
+  void iteration_binned(puzzler::ILog *log, const RankCsr &out, const RankBins &bins, float *values, const float *current, float *next) const
+  {
+    unsigned n=out.n;
+    unsigned B=bins.bins, C=bins.chunks;
+    const uint32_t *offsets=&out.offsets[0];
+    const uint32_t *targets=out.targets.empty() ? 0 : &out.targets[0];
+    const uint32_t *starts=&bins.starts[0];
+    const uint32_t *dest=bins.dest.empty() ? 0 : &bins.dest[0];
+
+    tbb::parallel_for(0u, C, [&](unsigned c){
+      std::vector<uint32_t> cursor(B);
+      for(unsigned b=0; b<B; b++){
+        cursor[b]=starts[b*C+c];
+      }
+      unsigned end=std::min(n, (c+1)*rank_grain);
+      for(unsigned i=c*rank_grain; i<end; i++){
+        float contrib=current[i] * out.inv_degree[i];
+        for(unsigned j=offsets[i]; j<offsets[i+1]; j++){
+          values[cursor[targets[j]>>bins.shift]++]=contrib;
+        }
+      }
+    });
+
+    double total=tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, B, 1), 0.0, [&](const tbb::blocked_range<unsigned> &r, double total){
+      for(unsigned b=r.begin(); b<r.end(); b++){
+        unsigned lo=b<<bins.shift, hi=std::min(n, (b+1)<<bins.shift);
+        std::fill(next+lo, next+hi, 0.0f);
+        for(unsigned k=starts[b*C]; k<starts[(b+1)*C]; k++){
+          next[dest[k]] += values[k];
+        }
+        for(unsigned v=lo; v<hi; v++){
+          next[v] = (current[v] * 0.3  + next[v] * 0.7 );
+          total += next[v];
+        }
+      }
+      return total;
+    }, std::plus<double>());
+    log->LogVerbose("  total=%g", total);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        next[i] /= total;
+      }
+    });
+  }
+
+public:
+  RankBinnedProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr out(pInput->edges);
+    unsigned n=out.n;
+
+    size_t cacheBytes=detect_cache_bytes();
+    RankBins bins=make_bins(out, cacheBytes);
+    log->LogInfo("Binning into %u bins of %u vertices (cache %uKB), %u source chunks.",
+      bins.bins, 1u<<bins.shift, unsigned(cacheBytes/1024), bins.chunks);
+
+    log->LogInfo("Starting iterations.");
+    std::vector<float> values(out.targets.size());
+    std::vector<float> curr(n, 0.0f);
+    curr[0]=1.0;
+    std::vector<float> next(n, 0.0f);
+    float dist=norm_tbb(n, &curr[0], &next[0]);
+    while( tol < dist ){
+      log->LogVerbose("dist=%g", dist);
+      iteration_binned(log, out, bins, values.empty() ? 0 : &values[0], &curr[0], &next[0]);
+      std::swap(curr, next);
+      dist=norm_tbb(n, &curr[0], &next[0]);
+    }
+
+    pOutput->ranks=curr;
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef user_rank_csr_hpp
+#define user_rank_csr_hpp
+
+#include "puzzler/puzzles/rank.hpp"
+
+/*
+  Flat compressed sparse row copy of RankInput::edges. The out-edges of
+  vertex i are targets[offsets[i]] to targets[offsets[i+1]-1], and
+  inv_degree[i] is 1/out-degree (0 for a vertex with no edges, which then
+  contributes nothing, as in the reference).
+
+  transposed() gives the in-edge form: row i then lists the sources of the
+  edges into i, in increasing source order, and inv_degree still belongs to
+  vertex i.
+*/
+struct RankCsr
+{
+  unsigned n;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> targets;
+  std::vector<float> inv_degree;
+
+  RankCsr()
+    : n(0)
+  {}
+
+  explicit RankCsr(const std::vector<std::vector<uint32_t> > &edges)
+    : n(edges.size())
+    , offsets(edges.size()+1)
+    , inv_degree(edges.size())
+  {
+    offsets[0]=0;
+    for(unsigned i=0; i<n; i++){
+      offsets[i+1]=offsets[i]+edges[i].size();
+      inv_degree[i]=edges[i].size() ? 1.0f/edges[i].size() : 0.0f;
+    }
+    targets.resize(offsets[n]);
+    for(unsigned i=0; i<n; i++){
+      std::copy(edges[i].begin(), edges[i].end(), targets.begin()+offsets[i]);
+    }
+  }
+
+  RankCsr transposed() const
+  {
+    RankCsr res;
+    res.n=n;
+    res.inv_degree=inv_degree;
+    res.offsets.assign(n+1, 0);
+    for(unsigned j=0; j<targets.size(); j++){
+      res.offsets[targets[j]+1]++;
+    }
+    for(unsigned i=0; i<n; i++){
+      res.offsets[i+1]+=res.offsets[i];
+    }
+    res.targets.resize(targets.size());
+    std::vector<uint32_t> fill(res.offsets.begin(), res.offsets.end()-1);
+    for(unsigned i=0; i<n; i++){
+      for(unsigned j=offsets[i]; j<offsets[i+1]; j++){
+        res.targets[fill[targets[j]]++]=i;
+      }
+    }
+    return res;
+  }
+};
+
+/*
+  The reference iteration on a CSR copy of the graph, built once per
+  Execute. The scatter loop then streams through offsets and targets, and
+  the division by the out-degree becomes a multiply by inv_degree.
+*/
+class RankCsrProvider
+  : public puzzler::RankPuzzle
+{
+protected:
+  void iteration_csr(puzzler::ILog *log, const RankCsr &csr, const float *current, float *next) const
+  {
+    unsigned n=csr.n;
+    const uint32_t *offsets=&csr.offsets[0];
+    const uint32_t *targets=csr.targets.empty() ? 0 : &csr.targets[0];
+
+    std::fill(next, next+n, 0.0f);
+    for(unsigned i=0; i<n; i++){
+      float contrib=current[i] * csr.inv_degree[i];
+      for(unsigned j=offsets[i]; j<offsets[i+1]; j++){
+        next[targets[j]] += contrib;
+      }
+    }
+
+    double total=0;
+    for(unsigned i=0; i<n; i++){
+      next[i] = (current[i] * 0.3  + next[i] * 0.7 );
+      total += next[i];
+    }
+    log->LogVerbose("  total=%g", total);
+    for(unsigned i=0; i<n; i++){
+      next[i] /= total;
+    }
+  }
+
+public:
+  RankCsrProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr csr(pInput->edges);
+    unsigned n=csr.n;
+
+    log->LogInfo("Starting iterations.");
+    std::vector<float> curr(n, 0.0f);
+    curr[0]=1.0;
+    std::vector<float> next(n, 0.0f);
+    float dist=norm(curr,next);
+    while( tol < dist ){
+      log->LogVerbose("dist=%g", dist);
+      iteration_csr(log, csr, &curr[0], &next[0]);
+      std::swap(curr, next);
+      dist=norm(curr, next);
+    }
+
+    pOutput->ranks=curr;
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef user_rank_fused_hpp
+#define user_rank_fused_hpp
+
+#include "rank_tbb.hpp"
+
+#include <climits>
+
+/*
+  Two passes over the vertices per iteration instead of the four in
+  rank.tbb (contrib, gather, normalise and norm):
+
+    gather:    y[v] = 0.3*x_k[v] + 0.7*sum(c_k[u] for u->v), reducing T = sum(y)
+    normalise: x_{k+1}[v] = y[v]/T, c_{k+1}[v] = x_{k+1}[v]*inv_degree[v],
+               reducing |x_{k+1} - x_k|^2
+
+  y is written over x_{k-1}, which is no longer needed, and normalised in
+  place, so there are two x arrays and one c array.
+
+  Every value goes through the same float roundings as in rank.tbb, and
+  the total and distance are reduced over the same chunks, so the iterates
+  and distances are bit-identical to execute_tbb's. That is why the
+  normalisation can't be folded into the gather (reading y_k and scaling
+  each contribution by 1/T_k as it is summed): that rounds differently,
+  and on slowly converging graphs, where the contraction rate is close to
+  1, a different rounding moves the iteration where the distance first
+  drops below tol. The ranks there differ from the reference's by far
+  more than CompareOutputs allows. Dividing every gathered value by T_k
+  instead rounds correctly, but a division per edge cost more than the
+  two passes saved.
+
+  The engines built on this one round differently, or stop somewhere
+  else, which is only safe when the graph converges quickly. They start
+  with execute_probe, which runs the first probe_iterations iterations
+  here and measures the contraction rate (the ratio of successive
+  distances) over the second half of them. The engine only carries on
+  with its own method if that is below slow_rate and the graph has at
+  least rank_small_n vertices; otherwise the iterations here run to the
+  end, and give exactly the rank.tbb answer. Over iterations 4 to 8 the
+  rate is at most 0.64 for random graphs from CreateInput (n=64 to 200,
+  200 seeds each), and at least 0.74 for rings, rings with chords and
+  tori.
+  Small graphs have tol below the float spacing near 1/n, so
+  CompareOutputs is close to asking for the reference's rounding.
+
+  A graph can still converge quickly at first and slowly later, so an
+  engine that hasn't finished after fast_limit iterations gives up and
+  starts again with execute_fused. Random graphs need 20 to 30.
+*/
+class RankFusedProvider
+  : public RankTbbProvider
+{
+protected:
+  enum{ rank_small_n=64, probe_iterations=8, fast_limit=100 };
+
+  //! Probed graphs with a contraction rate of at least this finish with execute_fused
+  static constexpr double slow_rate=0.7;
+
+  //! Writes 0.3*x+0.7*(gathered c) to y, and returns its total
+  double gather_fused(const RankCsr &in, const float *x, const float *c, float *y) const
+  {
+    unsigned n=in.n;
+    const uint32_t *offsets=&in.offsets[0];
+    const uint32_t *sources=in.targets.empty() ? 0 : &in.targets[0];
+
+    return tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double total){
+      for(unsigned v=r.begin(); v<r.end(); v++){
+        float acc=0;
+        for(unsigned j=offsets[v]; j<offsets[v+1]; j++){
+          acc += c[sources[j]];
+        }
+        y[v] = (x[v] * 0.3  + acc * 0.7 );
+        total += y[v];
+      }
+      return total;
+    }, std::plus<double>());
+  }
+
+  //! Divides y by total in place and writes its contributions to c; returns |y-x|
+  double normalise_fused(const RankCsr &in, float *y, double total, const float *x, float *c) const
+  {
+    const float *inv_degree=&in.inv_degree[0];
+
+    double dist2=tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, in.n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double dist2){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        y[i] /= total;
+        c[i]=y[i] * inv_degree[i];
+        double d=y[i]-x[i];
+        dist2 += d*d;
+      }
+      return dist2;
+    }, std::plus<double>());
+    return sqrt(dist2);
+  }
+
+  //! Writes x_{k+1} to xNext and c_{k+1} over c, from x_k and c_k; returns |x_{k+1}-x_k|
+  double iteration_fused(puzzler::ILog *log, const RankCsr &in, const float *x, float *c, float *xNext) const
+  {
+    double total=gather_fused(in, x, c, xNext);
+    log->LogVerbose("  total=%g", total);
+    return normalise_fused(in, xNext, total, x, c);
+  }
+
+  //! Iteration k of execute_fused: curr is x_k, contrib is c_k, and dist is |x_k-x_{k-1}|
+  struct FusedState
+  {
+    std::vector<float> curr, next, contrib;
+    float dist;
+    unsigned iterations;
+  };
+
+  //! x_0 has ranks[0]=1, and x_{-1} is zero as in the reference
+  void start_fused(const RankCsr &in, FusedState &s) const
+  {
+    unsigned n=in.n;
+    s.curr.assign(n, 0.0f);
+    s.curr[0]=1.0;
+    s.next.assign(n, 0.0f);
+    s.contrib.assign(n, 0.0f);
+    s.contrib[0]=s.curr[0] * in.inv_degree[0];
+    s.dist=norm_tbb(n, &s.curr[0], &s.next[0]);
+    s.iterations=0;
+  }
+
+  //! Iterates until dist is within tol (returning true) or iterations reaches maxIterations; each dist goes in dists if given
+  bool run_fused(puzzler::ILog *log, const RankCsr &in, float tol, FusedState &s, unsigned maxIterations=UINT_MAX, std::vector<float> *dists=0) const
+  {
+    while( tol < s.dist ){
+      if(s.iterations>=maxIterations){
+        return false;
+      }
+      log->LogVerbose("dist=%g", s.dist);
+      s.dist=iteration_fused(log, in, &s.curr[0], &s.contrib[0], &s.next[0]);
+      std::swap(s.curr, s.next);
+      s.iterations++;
+      if(dists){
+        dists->push_back(s.dist);
+      }
+    }
+    return true;
+  }
+
+  //! Runs the fused iterations from ranks[0]=1 and returns how many were needed
+  unsigned execute_fused(puzzler::ILog *log, const RankCsr &in, float tol, std::vector<float> &ranks) const
+  {
+    FusedState s;
+    start_fused(in, s);
+    run_fused(log, in, tol, s);
+    ranks.swap(s.curr);
+    return s.iterations;
+  }
+
+  /*! Starts execute_fused, and finishes it if the graph is small, it
+      converges within probe_iterations, or it converges slowly. Returns
+      true with the answer in ranks if so, otherwise false with s at
+      iteration probe_iterations. */
+  bool execute_probe(puzzler::ILog *log, const RankCsr &in, float tol, FusedState &s, std::vector<float> &ranks) const
+  {
+    start_fused(in, s);
+    std::vector<float> dists;
+    if(!run_fused(log, in, tol, s, probe_iterations, &dists)){
+      unsigned half=probe_iterations/2;
+      double rate=pow(double(dists[probe_iterations-1])/dists[half-1], 1.0/(probe_iterations-half));
+      if(in.n<rank_small_n){
+        log->LogInfo("Small graph, finishing with the exact iteration.");
+      }else if( !(rate<slow_rate) ){
+        log->LogInfo("Contraction rate %g, finishing with the exact iteration.", rate);
+      }else{
+        log->LogVerbose("Contraction rate %g", rate);
+        return false;
+      }
+      run_fused(log, in, tol, s);
+    }
+    ranks.swap(s.curr);
+    return true;
+  }
+
+  //! For an engine still going after fast_limit iterations: starts again with execute_fused
+  unsigned restart_fused(puzzler::ILog *log, const RankCsr &in, float tol, std::vector<float> &ranks) const
+  {
+    log->LogInfo("Not converged after %u iterations, starting again with the exact iteration.", unsigned(fast_limit));
+    return execute_fused(log, in, tol, ranks);
+  }
+
+public:
+  RankFusedProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+
+    log->LogInfo("Starting iterations.");
+    unsigned iterations=execute_fused(log, in, tol, pOutput->ranks);
+    log->LogInfo("Converged after %u iterations", iterations);
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
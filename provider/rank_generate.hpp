@@ -0,0 +1,154 @@
+#ifndef user_rank_generate_hpp
+#define user_rank_generate_hpp
+
+#include "rank_loader.hpp"
+
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+
+#include <ctime>
+
+/*
+  Fast generation of rank inputs. RankPuzzle::CreateInput draws every edge
+  in turn from one std::mt19937, so it can't be split up. Here each random
+  edge is a pure function of (seed, counter), with counter=i*degree+j for
+  edge j of vertex i: the counter is spread with the golden-ratio
+  increment of SplitMix64 and put through its finaliser, keyed by a mixed
+  seed. Any range of vertices can then be generated independently, and the
+  result is the same whatever the thread count or partitioning.
+
+  The graphs have the same shape as CreateInput's (degree ceil(2+n^0.2),
+  first edge i->(i+1)%n, the rest uniform over the vertices, tol=2e-8), but
+  they are different graphs from the same seed, as they come from a
+  different generator. Every vertex has the same degree, so the edges go
+  straight into a flat CSR with offsets[i]=i*degree.
+
+  The seed is DT10_DET_SEED if set, else the time, as in CreateInput.
+  create_puzzle_input (used by run_puzzle and rank_accuracy) takes this
+  path for rank when HPCE_RANK_FAST_INPUT is set, and uses the puzzle's own
+  CreateInput otherwise. generate_puzzle_input (used by the
+  create_puzzle_input tool) does the same, but writes a fast rank input
+  straight from the CSR without building the nested edge vectors at all.
+*/
+
+inline uint64_t rank_mix64(uint64_t z)
+{
+  z=(z ^ (z>>30)) * 0xBF58476D1CE4E5B9ull;
+  z=(z ^ (z>>27)) * 0x94D049BB133111EBull;
+  return z ^ (z>>31);
+}
+
+//! Word number counter of the random stream for key
+inline uint64_t rank_random(uint64_t key, uint64_t counter)
+{
+  return rank_mix64(key + (counter+1)*0x9E3779B97F4A7C15ull);
+}
+
+//! Seed from DT10_DET_SEED, or the time if it isn't set
+inline uint64_t rank_generate_seed()
+{
+  if(getenv("DT10_DET_SEED")){
+    return atoi(getenv("DT10_DET_SEED"));
+  }
+  return time(0);
+}
+
+//! Random out-edge CSR over n vertices, generated in parallel
+inline void rank_generate_csr(unsigned n, uint64_t seed, RankCsr &csr)
+{
+  enum{ grain=4096 };
+
+  unsigned degree=ceil(2+pow(n,0.2));
+  uint64_t key=rank_mix64(seed);
+
+  csr.n=n;
+  csr.offsets.resize(n+1);
+  csr.targets.resize(size_t(n)*degree);
+  csr.inv_degree.assign(n, 1.0f/degree);
+
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, grain), [&](const tbb::blocked_range<unsigned> &r){
+    for(unsigned i=r.begin(); i<r.end(); i++){
+      uint32_t *dst=&csr.targets[size_t(i)*degree];
+      dst[0]=(i+1)%n;
+      for(unsigned j=1; j<degree; j++){
+        uint32_t word=rank_random(key, uint64_t(i)*degree+j) >> 32;
+        dst[j]=(uint64_t(word)*n) >> 32;
+      }
+    }
+  });
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, n+1, grain), [&](const tbb::blocked_range<unsigned> &r){
+    for(unsigned i=r.begin(); i<r.end(); i++){
+      csr.offsets[i]=i*degree;
+    }
+  });
+}
+
+//! A RankInput for puzzle with no edges yet
+inline std::shared_ptr<puzzler::RankInput> rank_generate_header(const puzzler::Puzzle *puzzle, int scale)
+{
+  auto input=std::make_shared<puzzler::RankInput>(puzzle, scale);
+  input->tol=2e-8;
+  return input;
+}
+
+//! A RankInput for puzzle with the graph from rank_generate_csr
+inline std::shared_ptr<puzzler::RankInput> rank_generate_input(const puzzler::Puzzle *puzzle, int scale)
+{
+  RankCsr csr;
+  rank_generate_csr(scale, rank_generate_seed(), csr);
+
+  auto input=rank_generate_header(puzzle, scale);
+
+  std::vector<std::vector<uint32_t> > &edges=input->edges;
+  edges.resize(csr.n);
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, csr.n, 4096), [&](const tbb::blocked_range<unsigned> &r){
+    for(unsigned i=r.begin(); i<r.end(); i++){
+      edges[i].assign(csr.targets.begin()+csr.offsets[i], csr.targets.begin()+csr.offsets[i+1]);
+    }
+  });
+  return input;
+}
+
+/*! Ring i->i+1 over n vertices; if chord is non-zero every chord'th vertex
+    also links half way round. The second eigenvalue is within O(1/n^2) of
+    1, so these take hundreds of thousands of iterations at n=1000. */
+inline std::shared_ptr<puzzler::RankInput> rank_ring_input(const puzzler::Puzzle *puzzle, unsigned n, unsigned chord)
+{
+  auto input=rank_generate_header(puzzle, n);
+  input->edges.resize(n);
+  for(unsigned i=0; i<n; i++){
+    input->edges[i].push_back((i+1)%n);
+    if(chord && i%chord==0){
+      input->edges[i].push_back((i+n/2)%n);
+    }
+  }
+  return input;
+}
+
+//! As puzzle->CreateInput, but rank inputs come from rank_generate_input if HPCE_RANK_FAST_INPUT is set
+inline std::shared_ptr<puzzler::Puzzle::Input> create_puzzle_input(puzzler::ILog *log, const puzzler::Puzzle *puzzle, int scale)
+{
+  if(puzzle->Name()=="rank" && getenv("HPCE_RANK_FAST_INPUT")){
+    log->LogInfo("Generating rank input in parallel");
+    return rank_generate_input(puzzle, scale);
+  }
+  return puzzle->CreateInput(log, scale);
+}
+
+//! As create_puzzle_input then save_puzzle_input; fast rank inputs go from the CSR straight to dst
+inline void generate_puzzle_input(puzzler::ILog *log, const puzzler::Puzzle *puzzle, int scale, puzzler::Stream &dst)
+{
+  if(puzzle->Name()=="rank" && getenv("HPCE_RANK_FAST_INPUT")){
+    log->LogInfo("Generating rank input in parallel");
+    RankCsr csr;
+    rank_generate_csr(scale, rank_generate_seed(), csr);
+    log->LogInfo("Writing data");
+    rank_save_csr(dst, *rank_generate_header(puzzle, scale), csr);
+    return;
+  }
+  auto input=create_puzzle_input(log, puzzle, scale);
+  log->LogInfo("Writing data");
+  save_puzzle_input(dst, *input);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef user_rank_gs_hpp
+#define user_rank_gs_hpp
+
+#include "rank_fused.hpp"
+
+#include <atomic>
+#include <memory>
+
+/*
+  Gauss-Seidel sweeps on the pull graph. The fixed point of
+  x = 0.3*x + 0.7*P*x is the fixed point of x = P*x, so the damping only
+  slows things down, and each vertex can solve its own row of x = P*x
+  directly, in place:
+
+    x[v] = sum(c[u] for u->v, u!=v) / (1 - self[v]),    c[v] = x[v]*inv_degree[v]
+
+  where self[v] is the weight of v's edges to itself. c[v] is published
+  straight away, so sources later in the sweep already see the new value.
+  Blocks of vertices are swept in parallel without any ordering between
+  them (asynchronous block Gauss-Seidel): a source in another block gives
+  whichever of its old or new value is there when it is read. With one
+  thread that is exactly a sequential Gauss-Seidel sweep. c is an array of
+  relaxed atomics, which on x86 are ordinary loads and stores.
+
+  Starting from the reference's x[0]=1 would lose nearly all the mass in
+  the first sweep (vertex 0's sources are all zero), so the sweeps start
+  from the iterate left by execute_probe; the fixed point is unique, so
+  the answer doesn't depend on it. Nothing is normalised between sweeps. The
+  sweep-to-sweep distance is not the quantity the reference tests, so once
+  it drops below tol x is normalised and one plain iteration
+  (iteration_tbb) is run from it. If that step's distance is below tol its
+  result is returned, which meets the reference's stopping rule, otherwise
+  the sweeps carry on.
+
+  That is a point near the true fixed point, not the point where the
+  reference's iteration happens to stop. The two are within
+  CompareOutputs of each other when the graph converges quickly, but
+  when the contraction rate is close to 1 the reference stops far from
+  the fixed point. So the sweeps only run if execute_probe passes, and
+  otherwise the probe's exact iterations run to the end.
+*/
+class RankGaussSeidelProvider
+  : public RankFusedProvider
+{
+protected:
+  //! One in-place sweep; returns |x_new-x_old|^2 (summed in whatever order the blocks ran)
+  double sweep_gs(const RankCsr &in, float *x, std::atomic<float> *c) const
+  {
+    unsigned n=in.n;
+    const uint32_t *offsets=&in.offsets[0];
+    const uint32_t *sources=in.targets.empty() ? 0 : &in.targets[0];
+    const float *inv_degree=&in.inv_degree[0];
+
+    return tbb::parallel_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double dist2){
+      for(unsigned v=r.begin(); v<r.end(); v++){
+        float acc=0, self=0;
+        for(unsigned j=offsets[v]; j<offsets[v+1]; j++){
+          if(sources[j]==v){
+            self += inv_degree[v];
+          }else{
+            acc += c[sources[j]].load(std::memory_order_relaxed);
+          }
+        }
+        float xNext=acc/(1-self);
+        double d=xNext-x[v];
+        dist2 += d*d;
+        x[v]=xNext;
+        c[v].store(xNext * inv_degree[v], std::memory_order_relaxed);
+      }
+      return dist2;
+    }, std::plus<double>());
+  }
+
+  //! Sweeps from x until a plain step from it is within tol; false if not within fast_limit sweeps
+  bool execute_gs(puzzler::ILog *log, const RankCsr &in, float tol, std::vector<float> &x, std::vector<float> &ranks, unsigned &sweeps, unsigned &checks) const
+  {
+    unsigned n=in.n;
+
+    std::vector<float> next(n), contrib(n);
+    std::unique_ptr<std::atomic<float>[]> c(new std::atomic<float>[n]);
+    for(unsigned i=0; i<n; i++){
+      c[i].store(x[i] * in.inv_degree[i], std::memory_order_relaxed);
+    }
+
+    sweeps=0;
+    checks=0;
+    while(1){
+      if(sweeps>=fast_limit){
+        return false;
+      }
+      float dist=sqrt(sweep_gs(in, &x[0], &c[0]));
+      sweeps++;
+      log->LogVerbose("sweep dist=%g", dist);
+      if( tol < dist ){
+        continue;
+      }
+
+      double total=tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double total){
+        for(unsigned i=r.begin(); i<r.end(); i++){
+          total += x[i];
+        }
+        return total;
+      }, std::plus<double>());
+      tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+        for(unsigned i=r.begin(); i<r.end(); i++){
+          x[i] /= total;
+          c[i].store(x[i] * in.inv_degree[i], std::memory_order_relaxed);
+        }
+      });
+
+      iteration_tbb(log, in, &x[0], &contrib[0], &next[0]);
+      checks++;
+      float check=norm_tbb(n, &next[0], &x[0]);
+      log->LogVerbose("check dist=%g", check);
+      if( !(tol < check) ){
+        break;
+      }
+    }
+
+    ranks.swap(next);
+    return true;
+  }
+
+public:
+  RankGaussSeidelProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+
+    log->LogInfo("Starting iterations.");
+    FusedState probe;
+    unsigned sweeps, checks;
+    if(execute_probe(log, in, tol, probe, pOutput->ranks)){
+      log->LogInfo("Converged after %u plain iterations", probe.iterations);
+    }else if(execute_gs(log, in, tol, probe.curr, pOutput->ranks, sweeps, checks)){
+      log->LogInfo("Converged after %u plain iterations, %u Gauss-Seidel sweeps and %u more plain iterations", probe.iterations, sweeps, checks);
+    }else{
+      restart_fused(log, in, tol, pOutput->ranks);
+    }
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef user_rank_loader_hpp
+#define user_rank_loader_hpp
+
+#include "rank_csr.hpp"
+
+#include "puzzler/core/persist.hpp"
+
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RANK_LOADER_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+  Bulk loading of rank inputs. RankInput::PersistImpl goes through the
+  generic vector persistence, which is one 4 byte Stream::Recv (and, for the
+  file and stdin streams, one read() system call) per edge.
+
+  On the wire the edges are n, then for each vertex its out-degree followed
+  by its targets, then tol, all as big-endian words. rank_load_edges reads
+  each vertex's targets together with the word after them (the next
+  vertex's degree, or tol after the last one) in a single Recv, appending
+  straight onto one flat staging array, so there are n+2 reads in all. The
+  trailing word is popped off again, which leaves the targets contiguous,
+  and the whole array is byteswapped afterwards in parallel. The byteswap
+  is chosen once at runtime from the CPU features, as in ising_hrng.hpp
+  (pshufb with AVX2 or SSSE3, else ntohl), and can be forced with
+  HPCE_RANK_BSWAP=scalar|ssse3|avx2.
+
+  rank_load_input then fills in the nested edge vectors of a normal
+  RankInput from the staging array in parallel, and drops it.
+  load_puzzle_input is a drop-in for PuzzleRegistrar::LoadInput which takes
+  this path for rank inputs.
+
+  Writing has the same problem, so rank_send_input lays out the whole edge
+  section big-endian in one buffer (in parallel, as each vertex's position
+  is known from a prefix sum of the degrees) and sends it in one go, from
+  either a RankInput (rank_save_input) or a CSR (rank_save_csr).
+  save_puzzle_input is the matching drop-in for Input::Persist.
+*/
+
+//! Stream over a byte buffer; Send appends and Recv consumes from the front
+class MemoryStream
+  : public puzzler::Stream
+{
+private:
+  std::vector<uint8_t> m_data;
+  size_t m_readOffset;
+
+public:
+  MemoryStream()
+    : m_readOffset(0)
+  {}
+
+  virtual void Send(size_t cbData, const void *pData) override
+  {
+    const uint8_t *p=(const uint8_t*)pData;
+    m_data.insert(m_data.end(), p, p+cbData);
+  }
+
+  virtual void Recv(size_t cbData, void *pData) override
+  {
+    if(m_data.size()-m_readOffset < cbData){
+      throw std::runtime_error("MemoryStream::Recv - Not enough data.");
+    }
+    memcpy(pData, &m_data[m_readOffset], cbData);
+    m_readOffset+=cbData;
+  }
+
+  virtual uint64_t SendOffset() const override
+  { return m_data.size(); }
+
+  virtual uint64_t RecvOffset() const override
+  { return m_readOffset; }
+
+  const std::vector<uint8_t> &Data() const
+  { return m_data; }
+};
+
+typedef void (*bswap_fn_t)(uint32_t *p, size_t count);
+
+//! Converts count big-endian words to host order in place (or back again)
+inline void bswap_scalar(uint32_t *p, size_t count)
+{
+  for(size_t i=0; i<count; i++){
+    p[i]=ntohl(p[i]);
+  }
+}
+
+#ifdef RANK_LOADER_X86
+__attribute__((target("ssse3")))
+inline void bswap_ssse3(uint32_t *p, size_t count)
+{
+  const __m128i order=_mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  size_t i=0;
+  for(; i+4<=count; i+=4){
+    __m128i v=_mm_loadu_si128((const __m128i*)(p+i));
+    _mm_storeu_si128((__m128i*)(p+i), _mm_shuffle_epi8(v, order));
+  }
+  bswap_scalar(p+i, count-i);
+}
+
+__attribute__((target("avx2")))
+inline void bswap_avx2(uint32_t *p, size_t count)
+{
+  const __m256i order=_mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12, 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  size_t i=0;
+  for(; i+8<=count; i+=8){
+    __m256i v=_mm256_loadu_si256((const __m256i*)(p+i));
+    _mm256_storeu_si256((__m256i*)(p+i), _mm256_shuffle_epi8(v, order));
+  }
+  bswap_scalar(p+i, count-i);
+}
+#endif
+
+inline bswap_fn_t bswap_select(std::string &name)
+{
+  const char *force=getenv("HPCE_RANK_BSWAP");
+#ifdef RANK_LOADER_X86
+  __builtin_cpu_init();
+  bool hasAvx2=__builtin_cpu_supports("avx2");
+  bool hasSsse3=__builtin_cpu_supports("ssse3");
+#else
+  bool hasAvx2=false, hasSsse3=false;
+#endif
+  if(force){
+    name=force;
+    if(name=="scalar"){
+      return bswap_scalar;
+    }
+#ifdef RANK_LOADER_X86
+    if(name=="avx2" && hasAvx2){
+      return bswap_avx2;
+    }
+    if(name=="ssse3" && hasSsse3){
+      return bswap_ssse3;
+    }
+#endif
+    throw std::runtime_error("bswap_select - HPCE_RANK_BSWAP='"+name+"' is not supported on this machine.");
+  }
+#ifdef RANK_LOADER_X86
+  if(hasAvx2){
+    name="avx2";
+    return bswap_avx2;
+  }
+  if(hasSsse3){
+    name="ssse3";
+    return bswap_ssse3;
+  }
+#endif
+  name="scalar";
+  return bswap_scalar;
+}
+
+//! The byteswap chosen for this machine, and its name
+inline bswap_fn_t bswap_implementation(std::string *pName=0)
+{
+  static std::string name;
+  static bswap_fn_t fn=bswap_select(name);
+  if(pName){
+    *pName=name;
+  }
+  return fn;
+}
+
+//! Converts count big-endian words to host order in place (or back again)
+inline void bswap_block(uint32_t *p, size_t count)
+{
+  bswap_implementation()(p, count);
+}
+
+/*! Reads the data of RankInput::PersistImpl (edges then tol) from src into a
+    flat staging buffer: vertex i's targets are targets[offsets[i]] to
+    targets[offsets[i+1]-1], in host order. */
+inline void rank_load_edges(puzzler::Stream &src, std::vector<uint32_t> &offsets, std::vector<uint32_t> &targets, float &tol)
+{
+  enum{ grain=1<<16 };
+
+  uint32_t word;
+  src.Recv(4, &word);
+  unsigned n=ntohl(word);
+
+  offsets.assign(n+1, 0);
+  targets.clear();
+
+  // Holds the degree of the vertex about to be read, and finally tol
+  src.Recv(4, &word);
+  uint32_t pending=ntohl(word);
+  for(unsigned i=0; i<n; i++){
+    uint32_t degree=pending;
+    offsets[i+1]=offsets[i]+degree;
+
+    size_t begin=targets.size();
+    if(targets.capacity() < begin+degree+1){
+      targets.reserve(std::max<size_t>(2*targets.capacity(), begin+degree+1));
+    }
+    targets.resize(begin+degree+1);
+    src.Recv(4*(degree+1), &targets[begin]);
+    pending=ntohl(targets.back());
+    targets.pop_back();
+  }
+
+  union{
+    float f;
+    uint32_t u;
+  }bits;
+  bits.u=pending;
+  tol=bits.f;
+
+  uint32_t *p=targets.data();
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, targets.size(), grain), [&](const tbb::blocked_range<size_t> &r){
+    bswap_block(p+r.begin(), r.size());
+  });
+}
+
+//! Reads a RankInput whose format and name strings have already been read
+inline std::shared_ptr<puzzler::RankInput> rank_load_input(const std::string &format, const std::string &name, puzzler::Stream &src)
+{
+  uint32_t scale=0, serial=0;
+  puzzler::PersistContext ctxt(&src, false);
+  ctxt.SendOrRecv(scale).SendOrRecv(serial);
+
+  std::vector<uint32_t> offsets, targets;
+  float tol;
+  rank_load_edges(src, offsets, targets, tol);
+  unsigned n=offsets.size()-1;
+
+  // Let the usual constructor read the header fields, with no edges
+  MemoryStream header;
+  puzzler::PersistContext headerOut(&header, true);
+  uint32_t noEdges=0;
+  headerOut.SendOrRecv(scale).SendOrRecv(serial).SendOrRecv(noEdges).SendOrRecv(tol);
+  puzzler::PersistContext headerIn(&header, false);
+  auto input=std::make_shared<puzzler::RankInput>(format, name, headerIn);
+
+  std::vector<std::vector<uint32_t> > &edges=input->edges;
+  edges.resize(n);
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, 4096), [&](const tbb::blocked_range<unsigned> &r){
+    for(unsigned i=r.begin(); i<r.end(); i++){
+      edges[i].assign(targets.begin()+offsets[i], targets.begin()+offsets[i+1]);
+    }
+  });
+  return input;
+}
+
+//! As PuzzleRegistrar::LoadInput, but rank inputs are read in bulk
+inline std::shared_ptr<puzzler::Puzzle::Input> load_puzzle_input(puzzler::Stream &src)
+{
+  puzzler::PersistContext ctxt(&src, false);
+  std::string format, name;
+  ctxt.SendOrRecv(format).SendOrRecv(name);
+
+  auto puzzle=puzzler::PuzzleRegistrar::LookupPuzzle(name);
+  if(!puzzle){
+    throw std::runtime_error("load_puzzle_input - No handler for type '"+name+"'");
+  }
+  if(name=="rank"){
+    return rank_load_input(format, name, src);
+  }
+  return puzzle->LoadInput(format, name, ctxt);
+}
+
+/*! Writes input as Persist would, with the edges given by offsets (n+1
+    prefix sums of the degrees) and row(i) (vertex i's targets) sent in a
+    single Send. input.edges must be empty; only the header and tol are used. */
+template<class TOffsets, class TRow>
+inline void rank_send_input(puzzler::Stream &dst, puzzler::RankInput &input, const TOffsets &offsets, TRow row)
+{
+  enum{ grain=4096 };
+
+  unsigned n=offsets.size()-1;
+
+  // With no edges Persist gives the header, then n=0, then tol
+  MemoryStream header;
+  puzzler::PersistContext ctxt(&header, true);
+  input.Persist(ctxt);
+  const std::vector<uint8_t> &head=header.Data();
+
+  // Vertex i's degree goes at word 1+i+offsets[i], followed by its targets
+  std::vector<uint32_t> body(2+n+size_t(offsets[n]));
+  body[0]=n;
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, grain), [&](const tbb::blocked_range<unsigned> &r){
+    for(unsigned i=r.begin(); i<r.end(); i++){
+      uint32_t *p=&body[1+i+size_t(offsets[i])];
+      p[0]=offsets[i+1]-offsets[i];
+      std::copy(row(i), row(i)+p[0], p+1);
+    }
+  });
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, body.size()-1, 1<<16), [&](const tbb::blocked_range<size_t> &r){
+    bswap_block(&body[r.begin()], r.size());
+  });
+  memcpy(&body.back(), &head[head.size()-4], 4);    // tol, already big-endian
+
+  dst.Send(head.size()-8, &head[0]);
+  dst.Send(4*body.size(), &body[0]);
+}
+
+//! Writes input exactly as Persist would, but with the edges in a single Send
+inline void rank_save_input(puzzler::Stream &dst, puzzler::RankInput &input)
+{
+  std::vector<std::vector<uint32_t> > edges;
+  edges.swap(input.edges);
+
+  unsigned n=edges.size();
+  std::vector<size_t> offsets(n+1);
+  offsets[0]=0;
+  for(unsigned i=0; i<n; i++){
+    offsets[i+1]=offsets[i]+edges[i].size();
+  }
+  rank_send_input(dst, input, offsets, [&](unsigned i){ return edges[i].data(); });
+  edges.swap(input.edges);
+}
+
+//! Writes input, whose edges must be empty, as Persist would if its edges were those of csr
+inline void rank_save_csr(puzzler::Stream &dst, puzzler::RankInput &input, const RankCsr &csr)
+{
+  rank_send_input(dst, input, csr.offsets, [&](unsigned i){ return csr.targets.data()+csr.offsets[i]; });
+}
+
+//! As Input::Persist, but rank inputs are written in bulk
+inline void save_puzzle_input(puzzler::Stream &dst, puzzler::Puzzle::Input &input)
+{
+  puzzler::RankInput *rank=dynamic_cast<puzzler::RankInput*>(&input);
+  if(rank){
+    rank_save_input(dst, *rank);
+  }else{
+    puzzler::PersistContext ctxt(&dst, true);
+    input.Persist(ctxt);
+  }
+}
+
+#endif
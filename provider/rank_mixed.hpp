@@ -0,0 +1,250 @@
+#ifndef user_rank_mixed_hpp
+#define user_rank_mixed_hpp
+
+#include "rank_fused.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+/*
+  One pass over the vertices per iteration: pass k+1 reads the
+  unnormalised y_k (with total T_k) and contributions
+  c_k[u]=y_k[u]*inv_degree[u], and applies 1/T_k as a scale factor while
+  gathering, so nothing is normalised in memory. That rounds differently
+  from the reference, which is why rank.fused doesn't do it. All the
+  per-vertex arithmetic is in float rather than double, so the blend and
+  scale vectorise twice as wide. Only the two scalar reductions (the
+  total and the squared distance) need more than float precision, so
+  within each chunk they are float Kahan sums, and the chunk results are
+  combined in double by the deterministic reduction tree.
+
+  The gather source c can also be stored as bfloat16 (the top half of the
+  float, rounded to nearest even), halving the bytes behind the random
+  reads. That costs about 2^-9 relative error per contribution, which only
+  stays under tol once the ranks (about 1/n) are small enough, so by
+  default it is used when 2^-8/n < tol. HPCE_RANK_GATHER=float or bf16
+  forces one or the other. The rounding also puts a floor under the
+  convergence distance (about 2^-9/sqrt(n), far above tol), so once dist
+  stops shrinking c is rebuilt in float from y and the last iterations
+  run with the float gather. src/rank_accuracy.cpp measures the resulting
+  worst-case norm(ref,got)/sqrt(n) against tol, on random graphs and on
+  rings.
+
+  All that rounding moves the iteration where the distance first drops
+  below tol, which is only harmless when the graph converges quickly. So
+  this starts with execute_probe, and only switches to the single pass
+  from the probe's last two iterates if the probe passes.
+*/
+class RankMixedProvider
+  : public RankFusedProvider
+{
+protected:
+  //! bfloat16 iterations stop once dist shrinks by less than this per iteration
+  static constexpr float bf16_stall=0.8f;
+
+  struct FusedSums
+  {
+    double total;
+    double dist2;
+
+    FusedSums operator+(const FusedSums &o) const
+    { return FusedSums{total+o.total, dist2+o.dist2}; }
+  };
+
+  struct Kahan
+  {
+    float sum, comp;
+
+    void add(float x)
+    {
+      float y=x-comp;
+      float t=sum+y;
+      comp=(t-sum)-y;
+      sum=t;
+    }
+
+    double value() const
+    { return double(sum)-double(comp); }
+  };
+
+  struct bf16
+  {
+    uint16_t bits;
+
+    static bf16 from(float x)
+    {
+      uint32_t u;
+      memcpy(&u, &x, 4);
+      u += 0x7FFF + ((u>>16)&1);
+      return bf16{uint16_t(u>>16)};
+    }
+
+    operator float() const
+    {
+      uint32_t u=uint32_t(bits)<<16;
+      float x;
+      memcpy(&x, &u, 4);
+      return x;
+    }
+  };
+
+  static void store(float &dst, float x)
+  { dst=x; }
+
+  static void store(bf16 &dst, float x)
+  { dst=bf16::from(x); }
+
+  template<class TC>
+  FusedSums iteration_mixed(const RankCsr &in, const float *y, float scale, float *yPrev, float scalePrev, const TC *c, TC *cNext) const
+  {
+    unsigned n=in.n;
+    const uint32_t *offsets=&in.offsets[0];
+    const uint32_t *sources=in.targets.empty() ? 0 : &in.targets[0];
+    const float *inv_degree=&in.inv_degree[0];
+
+    return tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), FusedSums{0,0}, [&](const tbb::blocked_range<unsigned> &r, FusedSums sums){
+      Kahan total{0,0}, dist2{0,0};
+      for(unsigned v=r.begin(); v<r.end(); v++){
+        float x=y[v]*scale;
+        float d=x-yPrev[v]*scalePrev;
+        dist2.add(d*d);
+
+        float acc=0;
+        for(unsigned j=offsets[v]; j<offsets[v+1]; j++){
+          acc += c[sources[j]];
+        }
+        float yNext=x*0.3f + acc*scale*0.7f;
+        yPrev[v]=yNext;
+        store(cNext[v], yNext * inv_degree[v]);
+        total.add(yNext);
+      }
+      sums.total += total.value();
+      sums.dist2 += dist2.value();
+      return sums;
+    }, std::plus<FusedSums>());
+  }
+
+  //! Carries on from s with the single pass; with bf16First the gather source is bfloat16 until the distance stalls. False if not converged within fast_limit iterations
+  bool execute_mixed(puzzler::ILog *log, const RankCsr &in, float tol, bool bf16First, FusedState &s, std::vector<float> &ranks, unsigned &bf16Iterations) const
+  {
+    unsigned n=in.n;
+
+    // The probe's x_k and x_{k-1} are already normalised, so both scales start at 1
+    std::vector<float> &y=s.curr, &yOther=s.next;
+    std::vector<float> c, cOther;
+    std::vector<bf16> cHalf, cHalfOther;
+    if(bf16First){
+      cHalf.resize(n);
+      cHalfOther.resize(n);
+      tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+        for(unsigned i=r.begin(); i<r.end(); i++){
+          cHalf[i]=bf16::from(s.contrib[i]);
+        }
+      });
+    }else{
+      c.swap(s.contrib);
+      cOther.resize(n);
+    }
+    float scale=1.0f, scaleOther=1.0f;
+
+    unsigned &iterations=s.iterations;
+    unsigned probed=iterations;
+    float prevDist=INFINITY;
+    bf16Iterations=0;
+    while(1){
+      if(iterations>=fast_limit){
+        return false;
+      }
+      FusedSums sums;
+      if(c.empty()){
+        sums=iteration_mixed(in, &y[0], scale, &yOther[0], scaleOther, &cHalf[0], &cHalfOther[0]);
+      }else{
+        sums=iteration_mixed(in, &y[0], scale, &yOther[0], scaleOther, &c[0], &cOther[0]);
+      }
+      float dist=sqrt(sums.dist2);
+      if( !(tol < dist) ){
+        if(c.empty()){
+          bf16Iterations=iterations-probed;
+        }
+        break;
+      }
+      log->LogVerbose("dist=%g", dist);
+      log->LogVerbose("  total=%g", sums.total);
+      std::swap(y, yOther);
+      std::swap(c, cOther);
+      std::swap(cHalf, cHalfOther);
+      scaleOther=scale;
+      scale=float(1.0/sums.total);
+      iterations++;
+
+      // The rounding of c leaves dist at a floor far above tol, so finish in float
+      if(c.empty() && dist > bf16_stall*prevDist){
+        bf16Iterations=iterations-probed;
+        c.resize(n);
+        cOther.resize(n);
+        tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+          for(unsigned i=r.begin(); i<r.end(); i++){
+            c[i]=y[i] * in.inv_degree[i];
+          }
+        });
+        std::vector<bf16>().swap(cHalf);
+        std::vector<bf16>().swap(cHalfOther);
+      }
+      prevDist=dist;
+    }
+
+    ranks.resize(n);
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        ranks[i]=y[i]*scale;
+      }
+    });
+    return true;
+  }
+
+  static bool use_bf16(unsigned n, float tol)
+  {
+    const char *gather=getenv("HPCE_RANK_GATHER");
+    if(gather && !strcmp(gather, "bf16")){
+      return true;
+    }
+    if(gather && !strcmp(gather, "float")){
+      return false;
+    }
+    return ldexp(1.0, -8)/n < tol;
+  }
+
+public:
+  RankMixedProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+    unsigned n=in.n;
+
+    log->LogInfo("Starting iterations.");
+    FusedState probe;
+    unsigned bf16Iterations;
+    if(execute_probe(log, in, tol, probe, pOutput->ranks)){
+      log->LogInfo("Converged after %u exact iterations", probe.iterations);
+    }else if(execute_mixed(log, in, tol, use_bf16(n, tol), probe, pOutput->ranks, bf16Iterations)){
+      log->LogInfo("Converged after %u iterations, the first %u exact, then %u with a bfloat16 gather source",
+        probe.iterations, unsigned(probe_iterations), bf16Iterations);
+    }else{
+      restart_fused(log, in, tol, pOutput->ranks);
+    }
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef user_rank_opencl_hpp
+#define user_rank_opencl_hpp
+
+#include "rank_fused.hpp"
+
+#include "opencl_util.hpp"
+
+#include <cstring>
+
+/*
+  Runs the iterations on the device. The in-edge CSR and inv_degree are
+  uploaded once, and curr, next and the contributions stay in device
+  buffers for the whole run. Each iteration is three kernels from rank.cl:
+
+    - a gather, which blends into next and leaves per-work-group totals
+    - rank_reduce, a single work-group adding up those totals
+    - rank_normalise, which divides by the total, writes the next
+      contributions and leaves per-work-group squared distances
+    - rank_reduce again, adding up the distances
+
+  and the only transfer per iteration is the 4 byte squared distance.
+
+  The gather is either one work-item per vertex, or a "warp" of lanes
+  work-items per vertex striding through its sources. Rows are only worth
+  splitting when there is a warp's worth of sources per vertex on average,
+  or when a few very long rows would hold up the work-items that get them,
+  so the row mapping is used if the mean in-degree is at least row_min_mean
+  or the largest is over row_max_skew times the mean. The inputs from
+  CreateInput have a mean of about 2+n^0.2 and little spread, so they get
+  one vertex per work-item. HPCE_RANK_CL_MAPPING=vertex or row forces one.
+
+  All the sums are in float, and in a different order from the reference,
+  so the run starts with execute_probe on the host, as in the engines built
+  on rank.fused: small or slowly converging graphs finish there, and the
+  rest carry on from the probe's iterate on the device, starting again on
+  the host if they aren't done after fast_limit iterations. If there is no
+  OpenCL platform the probe just runs to the end on the host.
+*/
+class RankOpenCLProvider
+  : public RankFusedProvider
+{
+protected:
+  enum{ group_size=256, row_min_mean=32, row_max_skew=16, row_max_lanes=32 };
+
+  mutable OpenCLProgramCache m_program;
+
+  //! Lanes per vertex for the gather, or 1 for one work-item per vertex
+  unsigned choose_lanes(puzzler::ILog *log, const RankCsr &in) const
+  {
+    unsigned n=in.n;
+    unsigned maxDegree=0;
+    for(unsigned v=0; v<n; v++){
+      maxDegree=std::max(maxDegree, in.offsets[v+1]-in.offsets[v]);
+    }
+    double mean=in.targets.size()/double(n);
+
+    bool rows=mean>=row_min_mean || maxDegree>row_max_skew*mean;
+    const char *mapping=getenv("HPCE_RANK_CL_MAPPING");
+    if(mapping){
+      rows=!strcmp(mapping, "row");
+    }
+
+    unsigned lanes=1;
+    if(rows){
+      lanes=4;
+      while(lanes<row_max_lanes && 2*lanes<=mean){
+        lanes*=2;
+      }
+    }
+    log->LogInfo("In-degree mean %.1f, max %u: %u lanes per vertex", mean, maxDegree, lanes);
+    return lanes;
+  }
+
+  static unsigned round_up(unsigned x, unsigned m)
+  { return (x+m-1)/m*m; }
+
+public:
+  RankOpenCLProvider()
+    : m_program("rank.cl")
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+    unsigned n=in.n;
+
+    log->LogInfo("Starting iterations.");
+    FusedState s;
+    if(execute_probe(log, in, tol, s, pOutput->ranks)){
+      log->LogInfo("Finished");
+      return;
+    }
+
+    OpenCLProgram *program=m_program.get(log);
+    if(!program){
+      run_fused(log, in, tol, s);
+      pOutput->ranks.swap(s.curr);
+      log->LogInfo("Converged after %u iterations", s.iterations);
+      log->LogInfo("Finished");
+      return;
+    }
+    OpenCLProgram &cl=*program;
+
+    unsigned lanes=choose_lanes(log, in);
+    cl::CommandQueue queue(cl.context, cl.device);
+
+    unsigned local=group_size;
+    while(local>cl.device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()){
+      local/=2;
+    }
+    lanes=std::min(lanes, local);
+    unsigned gatherGlobal=round_up(n*lanes, local), gatherGroups=gatherGlobal/local;
+    unsigned vertexGlobal=round_up(n, local), vertexGroups=vertexGlobal/local;
+
+    log->LogInfo("Uploading graph.");
+    size_t m=std::max<size_t>(in.targets.size(), 1);
+    cl::Buffer offsets(cl.context, CL_MEM_READ_ONLY, 4*(n+1));
+    cl::Buffer sources(cl.context, CL_MEM_READ_ONLY, 4*m);
+    cl::Buffer invDegree(cl.context, CL_MEM_READ_ONLY, 4*n);
+    cl::Buffer curr(cl.context, CL_MEM_READ_WRITE, 4*n);
+    cl::Buffer next(cl.context, CL_MEM_READ_WRITE, 4*n);
+    cl::Buffer contrib(cl.context, CL_MEM_READ_WRITE, 4*n);
+    cl::Buffer partials(cl.context, CL_MEM_READ_WRITE, 4*gatherGroups);
+    cl::Buffer total(cl.context, CL_MEM_READ_WRITE, 4);
+    cl::Buffer distPartials(cl.context, CL_MEM_READ_WRITE, 4*vertexGroups);
+    cl::Buffer dist2(cl.context, CL_MEM_READ_WRITE, 4);
+
+    queue.enqueueWriteBuffer(offsets, CL_FALSE, 0, 4*(n+1), &in.offsets[0]);
+    if(!in.targets.empty()){
+      queue.enqueueWriteBuffer(sources, CL_FALSE, 0, 4*in.targets.size(), &in.targets[0]);
+    }
+    queue.enqueueWriteBuffer(invDegree, CL_FALSE, 0, 4*n, &in.inv_degree[0]);
+    queue.enqueueWriteBuffer(curr, CL_FALSE, 0, 4*n, &s.curr[0]);
+    queue.enqueueWriteBuffer(contrib, CL_TRUE, 0, 4*n, &s.contrib[0]);
+
+    cl::Kernel gatherKernel;
+    unsigned arg=0;
+    if(lanes==1){
+      gatherKernel=cl::Kernel(cl.program, "rank_gather_vertex");
+      gatherKernel.setArg(arg++, n);
+    }else{
+      gatherKernel=cl::Kernel(cl.program, "rank_gather_row");
+      gatherKernel.setArg(arg++, n);
+      gatherKernel.setArg(arg++, lanes);
+    }
+    gatherKernel.setArg(arg++, offsets);
+    gatherKernel.setArg(arg++, sources);
+    unsigned gatherCurrArg=arg++;
+    gatherKernel.setArg(arg++, contrib);
+    unsigned gatherNextArg=arg++;
+    gatherKernel.setArg(arg++, partials);
+    gatherKernel.setArg(arg++, cl::Local(4*local));
+
+    cl::Kernel totalKernel(cl.program, "rank_reduce");
+    totalKernel.setArg(0, gatherGroups);
+    totalKernel.setArg(1, partials);
+    totalKernel.setArg(2, total);
+    totalKernel.setArg(3, cl::Local(4*local));
+
+    cl::Kernel normaliseKernel(cl.program, "rank_normalise");
+    normaliseKernel.setArg(0, n);
+    normaliseKernel.setArg(1, total);
+    normaliseKernel.setArg(4, invDegree);
+    normaliseKernel.setArg(5, contrib);
+    normaliseKernel.setArg(6, distPartials);
+    normaliseKernel.setArg(7, cl::Local(4*local));
+
+    cl::Kernel reduceKernel(cl.program, "rank_reduce");
+    reduceKernel.setArg(0, vertexGroups);
+    reduceKernel.setArg(1, distPartials);
+    reduceKernel.setArg(2, dist2);
+    reduceKernel.setArg(3, cl::Local(4*local));
+
+    log->LogInfo("Continuing iterations on the device.");
+    float dist=s.dist;
+    unsigned iterations=s.iterations;
+    while( tol < dist ){
+      if(iterations>=fast_limit){
+        iterations=restart_fused(log, in, tol, pOutput->ranks);
+        log->LogInfo("Converged after %u iterations", iterations);
+        log->LogInfo("Finished");
+        return;
+      }
+      log->LogVerbose("dist=%g", dist);
+
+      gatherKernel.setArg(gatherCurrArg, curr);
+      gatherKernel.setArg(gatherNextArg, next);
+      queue.enqueueNDRangeKernel(gatherKernel, cl::NullRange, cl::NDRange(gatherGlobal), cl::NDRange(local));
+
+      queue.enqueueNDRangeKernel(totalKernel, cl::NullRange, cl::NDRange(local), cl::NDRange(local));
+
+      normaliseKernel.setArg(2, curr);
+      normaliseKernel.setArg(3, next);
+      queue.enqueueNDRangeKernel(normaliseKernel, cl::NullRange, cl::NDRange(vertexGlobal), cl::NDRange(local));
+
+      queue.enqueueNDRangeKernel(reduceKernel, cl::NullRange, cl::NDRange(local), cl::NDRange(local));
+
+      float d2;
+      queue.enqueueReadBuffer(dist2, CL_TRUE, 0, 4, &d2);
+      dist=sqrt(d2);
+      std::swap(curr, next);
+      iterations++;
+    }
+    log->LogInfo("Converged after %u iterations", iterations);
+
+    pOutput->ranks.resize(n);
+    queue.enqueueReadBuffer(curr, CL_TRUE, 0, 4*n, &pOutput->ranks[0]);
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
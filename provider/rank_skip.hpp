@@ -0,0 +1,110 @@
+#ifndef user_rank_skip_hpp
+#define user_rank_skip_hpp
+
+#include "rank_fused.hpp"
+
+/*
+  The rank.tbb iteration, without computing norm(curr,next) after every
+  iteration. The distance shrinks geometrically, so after the first
+  skip_warmup iterations (which are all checked) the rate r is estimated
+  from the last two checks, and the number of iterations still needed is
+  predicted as log(tol/dist)/log(r). The next check is placed skip_margin
+  iterations before that, and from there every iteration is checked again
+  until one passes, re-estimating the rate at each check.
+
+  The loop only stops on a check that passes, but a check that passes
+  after a gap of g iterations may be up to g-1 iterations past the one the
+  reference stops at. Those extra iterations each move the ranks by less
+  than tol, and CompareOutputs allows sqrt(n)*tol, so the gap is capped at
+  sqrt(n)/2. That also bounds the cost of a bad prediction: when the rate
+  is close to 1 (a slowly converging graph, or a noisy estimate)
+  log(tol/dist)/log(r) can be arbitrarily large. If the distance isn't
+  shrinking, every iteration is checked.
+
+  Graphs below rank_small_n use execute_tbb, as in rank.fused.
+*/
+class RankSkipProvider
+  : public RankFusedProvider
+{
+protected:
+  enum{ skip_warmup=4, skip_margin=2 };
+
+  //! As execute_tbb, but only computing the distance when it might pass; returns the iteration count
+  unsigned execute_skip(puzzler::ILog *log, const RankCsr &in, float tol, std::vector<float> &ranks, unsigned &checks) const
+  {
+    unsigned n=in.n;
+
+    std::vector<float> curr(n, 0.0f);
+    curr[0]=1.0;
+    std::vector<float> next(n, 0.0f);
+    std::vector<float> contrib(n);
+
+    unsigned maxGap=std::max(1u, unsigned(sqrt(double(n))/2));
+
+    unsigned iterations=0, nextCheck=0, prevCheck=0;
+    float prevDist=0;
+    checks=0;
+    while(1){
+      if(iterations>=nextCheck){
+        float dist=norm_tbb(n, &curr[0], &next[0]);
+        checks++;
+        if( !(tol < dist) ){
+          break;
+        }
+        log->LogVerbose("dist=%g", dist);
+
+        nextCheck=iterations+1;
+        if(iterations>=skip_warmup){
+          double rate=pow(dist/prevDist, 1.0/(iterations-prevCheck));
+          if(rate<1){
+            double remaining=ceil(std::log(tol/dist)/std::log(rate));
+            if(remaining>skip_margin+1){
+              nextCheck=iterations+unsigned(std::min(remaining-skip_margin, double(maxGap)));
+            }
+            log->LogVerbose("  rate=%g, predicting %g more iterations", rate, remaining);
+          }
+        }
+        prevDist=dist;
+        prevCheck=iterations;
+      }
+
+      iteration_tbb(log, in, &curr[0], &contrib[0], &next[0]);
+      std::swap(curr, next);
+      iterations++;
+    }
+
+    ranks=curr;
+    return iterations;
+  }
+
+public:
+  RankSkipProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    float tol=pInput->tol;
+
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+    unsigned n=in.n;
+
+    log->LogInfo("Starting iterations.");
+    if(n<rank_small_n){
+      execute_tbb(log, in, tol, pOutput->ranks);
+    }else{
+      unsigned checks;
+      unsigned iterations=execute_skip(log, in, tol, pOutput->ranks, checks);
+      log->LogInfo("Converged after %u iterations with %u convergence checks", iterations, checks);
+    }
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
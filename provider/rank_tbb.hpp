@@ -0,0 +1,117 @@
+#ifndef user_rank_tbb_hpp
+#define user_rank_tbb_hpp
+
+#include "rank_csr.hpp"
+
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/blocked_range.h"
+
+/*
+  Pull-based version of the iteration. With the in-edge CSR each next[v] is
+  a gather over the sources of v, so every output is written by exactly one
+  task and no atomics are needed:
+
+    contrib[u] = current[u] * inv_degree[u]
+    next[v]    = 0.3*current[v] + 0.7*sum(contrib[u] for u->v)
+
+  The sources of each vertex are in increasing order, so the float sums are
+  added in the same order as the push loop. The total and the convergence
+  norm are reduced in double with parallel_deterministic_reduce over fixed
+  chunks, so the result doesn't depend on how the work was scheduled.
+*/
+class RankTbbProvider
+  : public RankCsrProvider
+{
+protected:
+  enum{ rank_grain=4096 };
+
+  double norm_tbb(unsigned n, const float *a, const float *b) const
+  {
+    double acc=tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double acc){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        double d=a[i]-b[i];
+        acc += d*d;
+      }
+      return acc;
+    }, std::plus<double>());
+    return sqrt(acc);
+  }
+
+  void iteration_tbb(puzzler::ILog *log, const RankCsr &in, const float *current, float *contrib, float *next) const
+  {
+    unsigned n=in.n;
+    const uint32_t *offsets=&in.offsets[0];
+    const uint32_t *sources=in.targets.empty() ? 0 : &in.targets[0];
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        contrib[i]=current[i] * in.inv_degree[i];
+      }
+    });
+
+    double total=tbb::parallel_deterministic_reduce(tbb::blocked_range<unsigned>(0, n, rank_grain), 0.0, [&](const tbb::blocked_range<unsigned> &r, double total){
+      for(unsigned v=r.begin(); v<r.end(); v++){
+        float acc=0;
+        for(unsigned j=offsets[v]; j<offsets[v+1]; j++){
+          acc += contrib[sources[j]];
+        }
+        next[v] = (current[v] * 0.3  + acc * 0.7 );
+        total += next[v];
+      }
+      return total;
+    }, std::plus<double>());
+    log->LogVerbose("  total=%g", total);
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, n, rank_grain), [&](const tbb::blocked_range<unsigned> &r){
+      for(unsigned i=r.begin(); i<r.end(); i++){
+        next[i] /= total;
+      }
+    });
+  }
+
+  //! The iteration loop of ReferenceExecute, using iteration_tbb and norm_tbb; returns the iteration count
+  unsigned execute_tbb(puzzler::ILog *log, const RankCsr &in, float tol, std::vector<float> &ranks) const
+  {
+    unsigned n=in.n;
+
+    std::vector<float> curr(n, 0.0f);
+    curr[0]=1.0;
+    std::vector<float> next(n, 0.0f);
+    std::vector<float> contrib(n);
+    float dist=norm_tbb(n, &curr[0], &next[0]);
+    unsigned iterations=0;
+    while( tol < dist ){
+      log->LogVerbose("dist=%g", dist);
+      iteration_tbb(log, in, &curr[0], &contrib[0], &next[0]);
+      std::swap(curr, next);
+      dist=norm_tbb(n, &curr[0], &next[0]);
+      iterations++;
+    }
+
+    ranks=curr;
+    return iterations;
+  }
+
+public:
+  RankTbbProvider()
+  {}
+
+  virtual void Execute(
+         puzzler::ILog *log,
+         const puzzler::RankInput *pInput,
+         puzzler::RankOutput *pOutput
+         ) const override
+  {
+    log->LogInfo("Building CSR.");
+    RankCsr in=RankCsr(pInput->edges).transposed();
+
+    log->LogInfo("Starting iterations.");
+    execute_tbb(log, in, pInput->tol, pOutput->ranks);
+
+    log->LogInfo("Finished");
+  }
+
+};
+
+#endif
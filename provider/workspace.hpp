@@ -0,0 +1,174 @@
+#ifndef user_workspace_hpp
+#define user_workspace_hpp
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+#include <cstdlib>
+#include <type_traits>
+
+#include "tbb/enumerable_thread_specific.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/*
+  Scratch memory that outlives a single Execute, so that running many
+  puzzles back to back in one process doesn't page-fault and zero fresh
+  lattice buffers every time.
+
+  A Workspace is a set of numbered slots, each an uninitialised buffer that
+  grows geometrically and never shrinks. get<T> default-initialises the
+  objects in place, which starts their lifetimes (so handing out
+  std::atomic<unsigned> labels is well defined) but generates no code for
+  the trivial types allowed here. Contents are not kept when a slot grows,
+  and are whatever the last user left otherwise, so callers must
+  initialise everything they read. On Linux the memory comes straight from
+  mmap, and slots of 2MB or more are advised to use transparent huge pages.
+
+  WorkspacePool keeps one Workspace per thread for an engine object. A
+  Lease marks the thread's workspace as busy; if the same thread re-enters
+  (e.g. it steals another Execute while waiting inside a parallel_for) it
+  gets a private temporary workspace instead of sharing the busy one.
+*/
+class Workspace
+{
+private:
+  enum{ huge_page=2<<20 };
+
+  struct Block
+  {
+    void *ptr;
+    size_t bytes;
+  };
+
+  std::vector<Block> m_slots;
+
+  static void *allocate(size_t bytes)
+  {
+#ifdef __linux__
+    void *p=mmap(0, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p==MAP_FAILED){
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if(bytes>=huge_page){
+      madvise(p, bytes, MADV_HUGEPAGE);
+    }
+#endif
+#else
+    void *p=std::malloc(bytes);
+    if(!p){
+      throw std::bad_alloc();
+    }
+#endif
+    return p;
+  }
+
+  static void release(const Block &b)
+  {
+#ifdef __linux__
+    munmap(b.ptr, b.bytes);
+#else
+    std::free(b.ptr);
+#endif
+  }
+
+public:
+  bool busy;
+
+  Workspace()
+    : busy(false)
+  {}
+
+  Workspace(const Workspace &)=delete;
+  Workspace &operator=(const Workspace &)=delete;
+
+  ~Workspace()
+  {
+    for(unsigned i=0; i<m_slots.size(); i++){
+      if(m_slots[i].ptr){
+        release(m_slots[i]);
+      }
+    }
+  }
+
+  //! count default-initialised (so indeterminate) objects of T in the given slot
+  template<class T>
+  T *get(unsigned slot, size_t count)
+  {
+    static_assert(std::is_trivially_default_constructible<T>::value, "Workspace only holds trivial types");
+
+    size_t bytes=std::max<size_t>(count*sizeof(T), 1);
+    if(slot>=m_slots.size()){
+      m_slots.resize(slot+1, Block{0,0});
+    }
+    Block &b=m_slots[slot];
+    if(b.bytes<bytes){
+      size_t grown=std::max(bytes, 2*b.bytes);
+      if(grown>=huge_page){
+        grown=(grown+huge_page-1)/huge_page*huge_page;
+      }
+      if(b.ptr){
+        release(b);
+        b.ptr=0;
+        b.bytes=0;
+      }
+      b.ptr=allocate(grown);
+      b.bytes=grown;
+    }
+    T *p=(T*)b.ptr;
+    for(size_t i=0; i<count; i++){
+      new (p+i) T;
+    }
+    return p;
+  }
+};
+
+class WorkspacePool
+{
+private:
+  tbb::enumerable_thread_specific<std::unique_ptr<Workspace> > m_workspaces;
+
+public:
+  class Lease
+  {
+  private:
+    Workspace *m_workspace;
+    std::unique_ptr<Workspace> m_temporary;
+
+  public:
+    Lease(WorkspacePool &pool)
+    {
+      std::unique_ptr<Workspace> &local=pool.m_workspaces.local();
+      if(!local){
+        local.reset(new Workspace());
+      }
+      if(local->busy){
+        m_temporary.reset(new Workspace());
+        m_workspace=m_temporary.get();
+      }else{
+        m_workspace=local.get();
+      }
+      m_workspace->busy=true;
+    }
+
+    Lease(const Lease &)=delete;
+    Lease &operator=(const Lease &)=delete;
+
+    ~Lease()
+    {
+      m_workspace->busy=false;
+    }
+
+    Workspace &operator*() const
+    { return *m_workspace; }
+
+    Workspace *operator->() const
+    { return m_workspace; }
+  };
+};
+
+#endif
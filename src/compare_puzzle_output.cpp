@@ -1,6 +1,8 @@
 
 #include "puzzler/puzzler.hpp"
 
+#include "../provider/rank_loader.hpp"
+
 #include <iostream>
 
 
@@ -35,9 +37,7 @@ int main(int argc, char *argv[])
       std::shared_ptr<puzzler::Puzzle::Input> input;
       {
         puzzler::FileInStream src(inputName);
-        puzzler::PersistContext ctxt(&src, false);
-
-        input=puzzler::PuzzleRegistrar().LoadInput(ctxt);
+        input=load_puzzle_input(src);
      }
 
      std::string puzzleName=input->PuzzleName();
@@ -1,6 +1,8 @@
 
 #include "puzzler/puzzler.hpp"
 
+#include "../provider/rank_generate.hpp"
+
 #include <iostream>
 
 
@@ -10,6 +12,7 @@ int main(int argc, char *argv[])
 
    if(argc<3){
       fprintf(stderr, "create_puzzle_input name scale [logLevel]\n");
+      fprintf(stderr, "  Set HPCE_RANK_FAST_INPUT to generate rank inputs in parallel (different graphs from the same seed).\n");
       std::cout<<"Puzzles:\n";
       puzzler::PuzzleRegistrar::ListPuzzles();
       exit(1);
@@ -36,14 +39,8 @@ int main(int argc, char *argv[])
          throw std::runtime_error("No puzzle registered with name "+name);
 
       logDest->LogInfo("Creating random input");
-      auto input=puzzle->CreateInput(logDest.get(), scale);
-
-      logDest->LogInfo("Writing data to stdout");
-      {
-         puzzler::StdoutStream dst;
-         puzzler::PersistContext ctxt(&dst, true);
-         input->Persist(ctxt);
-      }
+      puzzler::StdoutStream dst;
+      generate_puzzle_input(logDest.get(), puzzle.get(), scale, dst);
    }catch(std::string &msg){
       std::cerr<<"Caught error string : "<<msg<<std::endl;
       return 1;
@@ -1,6 +1,8 @@
 
 #include "puzzler/puzzler.hpp"
 
+#include "../provider/rank_loader.hpp"
+
 #include <iostream>
 
 
@@ -27,9 +29,7 @@ int main(int argc, char *argv[])
       std::shared_ptr<puzzler::Puzzle::Input> input;
       {
          puzzler::StdinStream src;
-         puzzler::PersistContext ctxt(&src, false);
-
-         input=puzzler::PuzzleRegistrar().LoadInput(ctxt);
+         input=load_puzzle_input(src);
       }
 
       logDest->Log(puzzler::Log_Info, "Loaded input, puzzle=%s", input->PuzzleName().c_str());
@@ -0,0 +1,105 @@
+#include "puzzler/puzzler.hpp"
+#include "puzzler/puzzles/rank.hpp"
+
+#include "../provider/rank_generate.hpp"
+
+#include <iostream>
+
+// Rings converge in O(n^2) iterations, so larger ones take too long
+const int max_ring_scale=1000;
+
+//! Runs input through the engine and the reference; returns norm(ref,got)/sqrt(n) and counts a failure
+double measure(puzzler::ILog *log, const puzzler::Puzzle *puzzle, const puzzler::Puzzle::Input *input, int &failures)
+{
+   auto got=puzzle->MakeEmptyOutput(input);
+   puzzle->Execute(log, input, got.get());
+   auto ref=puzzle->MakeEmptyOutput(input);
+   puzzle->ReferenceExecute(log, input, ref.get());
+
+   const std::vector<float> &r=dynamic_cast<puzzler::RankOutput*>(ref.get())->ranks;
+   const std::vector<float> &g=dynamic_cast<puzzler::RankOutput*>(got.get())->ranks;
+   double acc=0;
+   for(unsigned j=0; j<r.size(); j++){
+      acc += pow(double(r[j])-double(g[j]), 2.0);
+   }
+
+   if(!puzzle->CompareOutputs(log, input, ref.get(), got.get())){
+      failures++;
+   }
+   return sqrt(acc)/sqrt(double(r.size()));
+}
+
+int main(int argc, char *argv[])
+{
+   puzzler::PuzzleRegistrar::UserRegisterPuzzles();
+
+   if(argc<4){
+      fprintf(stderr, "rank_accuracy engine seeds scale [scale ...]\n");
+      fprintf(stderr, "  For each scale, runs seeds 1..seeds (via DT10_DET_SEED) through the engine and\n");
+      fprintf(stderr, "  the reference, and prints the worst norm(ref,got)/sqrt(n) against tol. Scales up\n");
+      fprintf(stderr, "  to %d also run a plain ring and a ring with chords, which converge slowly.\n", max_ring_scale);
+      fprintf(stderr, "  Set HPCE_ACCURACY_LOG_LEVEL to change the log level (default 1).\n");
+      fprintf(stderr, "  Set HPCE_RANK_FAST_INPUT to use the parallel input generator.\n");
+      exit(1);
+   }
+
+   try{
+      std::string name=argv[1];
+      int seeds=atoi(argv[2]);
+
+      int logLevel=1;
+      if(getenv("HPCE_ACCURACY_LOG_LEVEL")){
+         logLevel=atoi(getenv("HPCE_ACCURACY_LOG_LEVEL"));
+      }
+
+      std::shared_ptr<puzzler::ILog> logDest=std::make_shared<puzzler::LogDest>("rank_accuracy", logLevel);
+      logDest->Log(puzzler::Log_Info, "Created log.");
+
+      auto puzzle=puzzler::PuzzleRegistrar::LookupEngine(name);
+      if(!puzzle)
+	    throw std::runtime_error("No engine registered with name "+name);
+      if(puzzle->Name()!="rank")
+	    throw std::runtime_error("Engine "+name+" is not a rank engine");
+
+      printf("%10s %8s %6s %14s %10s %10s %s\n", "scale", "graph", "seeds", "worst err/rtn", "tol", "worst/tol", "failures");
+      bool allOk=true;
+      for(int i=3; i<argc; i++){
+         int scale=atoi(argv[i]);
+         double worst=0, tol=0;
+         int failures=0;
+         for(int seed=1; seed<=seeds; seed++){
+            setenv("DT10_DET_SEED", std::to_string(seed).c_str(), 1);
+            auto input=create_puzzle_input(logDest.get(), puzzle.get(), scale);
+            worst=std::max(worst, measure(logDest.get(), puzzle.get(), input.get(), failures));
+            tol=dynamic_cast<const puzzler::RankInput*>(input.get())->tol;
+         }
+         printf("%10d %8s %6d %14.3e %10.3e %10.4f %d\n", scale, "random", seeds, worst, tol, worst/tol, failures);
+         fflush(stdout);
+         allOk = allOk && failures==0;
+
+         if(scale>max_ring_scale){
+            continue;
+         }
+         for(unsigned chord : {0u, 7u}){
+            auto input=rank_ring_input(puzzle.get(), scale, chord);
+            failures=0;
+            double err=measure(logDest.get(), puzzle.get(), input.get(), failures);
+            printf("%10d %8s %6d %14.3e %10.3e %10.4f %d\n", scale, chord ? "ring+7" : "ring", 1, err, input->tol, err/input->tol, failures);
+            fflush(stdout);
+            allOk = allOk && failures==0;
+         }
+      }
+
+      return allOk ? 0 : 1;
+
+   }catch(std::string &msg){
+      std::cerr<<"Caught error string : "<<msg<<std::endl;
+      return 1;
+   }catch(std::exception &e){
+      std::cerr<<"Caught exception : "<<e.what()<<std::endl;
+      return 1;
+   }catch(...){
+      std::cerr<<"Caught unknown exception."<<std::endl;
+      return 1;
+   }
+}
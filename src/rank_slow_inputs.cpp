@@ -0,0 +1,91 @@
+#include "puzzler/puzzler.hpp"
+#include "puzzler/puzzles/rank.hpp"
+
+#include "../provider/rank_generate.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+
+
+int main(int argc, char *argv[])
+{
+   puzzler::PuzzleRegistrar::UserRegisterPuzzles();
+
+   if(argc<3){
+      fprintf(stderr, "rank_slow_inputs engine[,engine ...] n [n ...]\n");
+      fprintf(stderr, "  For each engine and n, runs a plain ring and a ring with chords (graphs which\n");
+      fprintf(stderr, "  converge very slowly) through the engine and the reference, and checks the\n");
+      fprintf(stderr, "  outputs match.\n");
+      fprintf(stderr, "  Set HPCE_ACCURACY_LOG_LEVEL to change the log level (default 1).\n");
+      exit(1);
+   }
+
+   try{
+      std::vector<std::string> names;
+      std::stringstream list(argv[1]);
+      std::string name;
+      while(std::getline(list, name, ',')){
+         names.push_back(name);
+      }
+
+      int logLevel=1;
+      if(getenv("HPCE_ACCURACY_LOG_LEVEL")){
+         logLevel=atoi(getenv("HPCE_ACCURACY_LOG_LEVEL"));
+      }
+
+      std::shared_ptr<puzzler::ILog> logDest=std::make_shared<puzzler::LogDest>("rank_slow_inputs", logLevel);
+      logDest->Log(puzzler::Log_Info, "Created log.");
+
+      std::vector<std::shared_ptr<puzzler::Puzzle> > puzzles;
+      for(const std::string &name : names){
+         auto puzzle=puzzler::PuzzleRegistrar::LookupEngine(name);
+         if(!puzzle)
+	       throw std::runtime_error("No engine registered with name "+name);
+         if(puzzle->Name()!="rank")
+	       throw std::runtime_error("Engine "+name+" is not a rank engine");
+         puzzles.push_back(puzzle);
+      }
+
+      printf("%14s %10s %6s %10s %10s %s\n", "engine", "n", "chord", "engine(s)", "ref(s)", "result");
+      bool allOk=true;
+      for(unsigned e=0; e<puzzles.size(); e++){
+         const puzzler::Puzzle *puzzle=puzzles[e].get();
+         for(int i=2; i<argc; i++){
+            unsigned n=atoi(argv[i]);
+            for(unsigned chord : {0u, 7u}){
+               auto input=rank_ring_input(puzzle, n, chord);
+
+               auto t0=std::chrono::steady_clock::now();
+               auto got=puzzle->MakeEmptyOutput(input.get());
+               puzzle->Execute(logDest.get(), input.get(), got.get());
+               auto t1=std::chrono::steady_clock::now();
+               auto ref=puzzle->MakeEmptyOutput(input.get());
+               puzzle->ReferenceExecute(logDest.get(), input.get(), ref.get());
+               auto t2=std::chrono::steady_clock::now();
+
+               bool ok=puzzle->CompareOutputs(logDest.get(), input.get(), ref.get(), got.get());
+               printf("%14s %10u %6u %10.3f %10.3f %s\n", names[e].c_str(), n, chord,
+                  std::chrono::duration<double>(t1-t0).count(), std::chrono::duration<double>(t2-t1).count(),
+                  ok ? "ok" : "FAIL");
+               fflush(stdout);
+               allOk = allOk && ok;
+            }
+         }
+      }
+
+      return allOk ? 0 : 1;
+
+   }catch(std::string &msg){
+      std::cerr<<"Caught error string : "<<msg<<std::endl;
+      return 1;
+   }catch(std::exception &e){
+      std::cerr<<"Caught exception : "<<e.what()<<std::endl;
+      return 1;
+   }catch(...){
+      std::cerr<<"Caught unknown exception."<<std::endl;
+      return 1;
+   }
+
+   return 0;
+}
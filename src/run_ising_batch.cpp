@@ -0,0 +1,78 @@
+#include "puzzler/puzzler.hpp"
+
+#include "../provider/ising_batch.hpp"
+
+#include <iostream>
+
+
+int main(int argc, char *argv[])
+{
+   puzzler::PuzzleRegistrar::UserRegisterPuzzles();
+
+   if(argc<3){
+      fprintf(stderr, "run_ising_batch engine scale [scale ...]\n");
+      fprintf(stderr, "  Set HPCE_BATCH_LOG_LEVEL to change the log level (default 2).\n");
+      exit(1);
+   }
+
+   try{
+      std::string name=argv[1];
+
+      int logLevel=2;
+      if(getenv("HPCE_BATCH_LOG_LEVEL")){
+         logLevel=atoi(getenv("HPCE_BATCH_LOG_LEVEL"));
+      }
+
+      std::shared_ptr<puzzler::ILog> logDest=std::make_shared<puzzler::LogDest>("run_ising_batch", logLevel);
+      logDest->Log(puzzler::Log_Info, "Created log.");
+
+      auto puzzle=puzzler::PuzzleRegistrar::LookupEngine(name);
+      if(!puzzle)
+	    throw std::runtime_error("No engine registered with name "+name);
+      auto batch=std::dynamic_pointer_cast<IsingBatchProvider>(puzzle);
+      if(!batch)
+	    throw std::runtime_error("Engine "+name+" does not support batches");
+
+      logDest->LogInfo("Creating random inputs");
+      std::vector<std::shared_ptr<puzzler::Puzzle::Input> > inputs;
+      std::vector<std::shared_ptr<puzzler::Puzzle::Output> > gots;
+      std::vector<const puzzler::IsingInput*> batchInputs;
+      std::vector<puzzler::IsingOutput*> batchOutputs;
+      for(int i=2; i<argc; i++){
+         inputs.push_back(puzzle->CreateInput(logDest.get(), atoi(argv[i])));
+         gots.push_back(puzzle->MakeEmptyOutput(inputs.back().get()));
+         batchInputs.push_back(dynamic_cast<const puzzler::IsingInput*>(inputs.back().get()));
+         batchOutputs.push_back(dynamic_cast<puzzler::IsingOutput*>(gots.back().get()));
+      }
+
+      logDest->LogInfo("Executing batch");
+      double start=puzzler::now()*1e-9;
+      batch->ExecuteBatch(logDest.get(), batchInputs, batchOutputs);
+      logDest->LogInfo("Batch took %.3f seconds", puzzler::now()*1e-9-start);
+
+      logDest->LogInfo("Executing reference");
+      for(unsigned i=0; i<inputs.size(); i++){
+         auto ref=puzzle->MakeEmptyOutput(inputs[i].get());
+         puzzle->ReferenceExecute(logDest.get(), inputs[i].get(), ref.get());
+
+         if(!puzzle->CompareOutputs(logDest.get(), inputs[i].get(), ref.get(), gots[i].get())){
+            logDest->LogFatal("Output %u is not correct.", i);
+            exit(1);
+         }
+      }
+      logDest->LogInfo("Output is correct");
+
+
+   }catch(std::string &msg){
+      std::cerr<<"Caught error string : "<<msg<<std::endl;
+      return 1;
+   }catch(std::exception &e){
+      std::cerr<<"Caught exception : "<<e.what()<<std::endl;
+      return 1;
+   }catch(...){
+      std::cerr<<"Caught unknown exception."<<std::endl;
+      return 1;
+   }
+
+   return 0;
+}
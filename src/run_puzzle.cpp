@@ -1,6 +1,8 @@
 
 #include "puzzler/puzzler.hpp"
 
+#include "../provider/rank_generate.hpp"
+
 #include <iostream>
 
 
@@ -10,6 +12,7 @@ int main(int argc, char *argv[])
 
    if(argc<3){
       fprintf(stderr, "run_puzzle engine scale [logLevel]\n");
+      fprintf(stderr, "  Set HPCE_RANK_FAST_INPUT to generate rank inputs in parallel.\n");
       std::cout<<"Puzzles:\n";
       puzzler::PuzzleRegistrar::ListEngines();
       exit(1);
@@ -36,7 +39,7 @@ int main(int argc, char *argv[])
 	    throw std::runtime_error("No engine registered with name "+name);
 
       logDest->LogInfo("Creating random input");
-      auto input=puzzle->CreateInput(logDest.get(), scale);
+      auto input=create_puzzle_input(logDest.get(), puzzle.get(), scale);
 
       logDest->LogInfo("Executing puzzle");
       auto got=puzzle->MakeEmptyOutput(input.get());